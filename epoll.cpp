@@ -23,20 +23,71 @@
  * SOFTWARE.
  */
 #include "epoll.h"
-#ifdef _WIN32
-#include <bcrypt.h>
-#include <mswsock.h>
-#endif
-#include <map>
+#include "fdtable.h"
+#include "slab.h"
+#include "epoll_et.h"
+#include "epoll_backend.h"
+#include "timerwheel.h"
 #include <mutex>
+#include <atomic>
+#include <new>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 #include <errno.h>
+#include <limits.h>
 #include <assert.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#endif
 
 
+#ifdef EPOLL_EMULATION
+#define EPOLL_CTLBITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+#define EPOLL_SLAB_RECORDS 64
+#define EPOLL_DRAIN_TIMEOUT 1000
+#define EPOLL_WAIT_BATCH 4096
+/*
+ * EPOLL_SHARDED completion ports: the most an instance gets, and how long
+ * a waiter blocks on its home port before looking at the others again,
+ * when some port has nobody blocked on it (steal) or all have (park)
+ */
+#define EPOLL_MAX_PORTS 16
+#define EPOLL_STEAL_MS 1
+#define EPOLL_PARK_MS 10
+/*epoll_setworker ids whose NUMA node is remembered*/
+#define EPOLL_MAX_WORKERS 1024
+/*_epoll_ctlop worker argument: no hint, MOD leaves the registration where it is*/
+#define EPOLL_WORKER_KEEP (-2)
+/*completion key of the posted entry that hands an exclusive poll over*/
+#define EPOLL_XTOKEN_KEY (~(uintptr_t)1)
+/*completion key of an eventfd poll, the value carries its events*/
+#define EPOLL_EVFD_KEY (~(uintptr_t)2)
+/*completion key of epoll_postqueued*/
+#define EPOLL_WAKEUP_KEY (~(uintptr_t)3)
+#define EPOLL_EVFD_MAX (UINT64_MAX - 1)
+/*first adaptive busy poll budget in us, halving below it turns spinning off*/
+#define EPOLL_SPIN_MIN 10
+/*
+ * how far short of a high resolution deadline a blocking dequeue stops,
+ * the rest is spun. Covers the overshoot of a ms timeout: the hrtimer
+ * slack on Linux, the timer tick on Windows.
+ */
+#ifndef EPOLL_HIRES_SLACK_NS
 #ifdef _WIN32
-#define EPOLL_MAX_FD 2000000
-#define IOCTL_AFD_POLL 0x00012024
-static std::recursive_mutex m1;
+#define EPOLL_HIRES_SLACK_NS 2000000
+#else
+#define EPOLL_HIRES_SLACK_NS 200000
+#endif
+#endif
+/*stats shards per instance, threads are spread over them round robin*/
+#define EPOLL_STATS_SHARDS 16
 
 enum class epoll_status {
     EPOLL_IDLE,
@@ -44,509 +95,2599 @@ enum class epoll_status {
     EPOLL_CANCELLED
 };
 
-typedef struct _AFD_POLL_HANDLE_INFO {
-    HANDLE Handle;
-    ULONG Events;
-    NTSTATUS Status;
-} AFD_POLL_HANDLE_INFO, * PAFD_POLL_HANDLE_INFO;
+struct _epoll_info;
+struct _epoll_instance;
 
-typedef struct _AFD_POLL_INFO {
-    LARGE_INTEGER Timeout;
-    ULONG NumberOfHandles;
-    ULONG Exclusive;
-    AFD_POLL_HANDLE_INFO Handles[1];
-} AFD_POLL_INFO, * PAFD_POLL_INFO;
+/*intrusive list of epoll_info, a record is on at most one list at a time*/
+typedef struct _epoll_list {
+    struct _epoll_info* head;
+    struct _epoll_info* tail;
+} epoll_list, *pepoll_list;
 
+/*
+ * ownership: while a poll is outstanding the backend owns poll, the
+ * completion hands the record to the thread that dequeued it and it stays
+ * that thread's until it is queued again. Every other field and all
+ * pollstatus transitions are under the instance lock.
+ */
 typedef struct _epoll_info {
-    OVERLAPPED ol;
-    AFD_POLL_INFO pollinfo;
+    /*first, a completion's poll pointer is the record*/
+    epoll_poll poll;
     epoll_status pollstatus;
     uint32_t pendingevents;
     char pendingdelete;
+    char detached;
     epoll_event epollevent;
-    HANDLE phwnd;
-    SOCKET socket;
-    SOCKET peer_socket;
+    int fd;
+    epoll_et_state et;
+    struct _epoll_instance* inst;
+    /*the instance port its polls complete on, ports[portno]*/
+    pepoll_port port;
+    uint32_t portno;
+    /*set for EPOLLEXCLUSIVE registrations*/
+    struct _epoll_xgroup* xgroup;
+    /*set for eventfd registrations, polled by the engine instead of the backend*/
+    struct _epoll_evfd* evfd;
+    uint32_t evfdevents;
+    char evfdarmed;
+    /*regular file, always ready and polled by the engine like an eventfd*/
+    char file;
+    /*link on the instance rearm or etdeferred list*/
+    pepoll_list list;
+    struct _epoll_info* prev;
+    struct _epoll_info* next;
 }epoll_info, *pepoll_info;
 
-static std::map<int, HANDLE> mfd2hwnd;
-static std::map<int, socket_t> mfd2sock;
-static std::map<socket_t, int> msock2fd;
-static std::map<int, pepoll_info> mevents;
-static std::map<int, pepoll_info> mevents_copy;
-static int epfdctr = 0;
-static int fdctr = 0;
+/*
+ * epoll_timer_create record, its pseudo-fd lives in the instance timerfds
+ * table. Everything is under the instance lock.
+ */
+typedef struct _epoll_timer {
+    /*first, the wheel hands back the node*/
+    timer_node node;
+    epoll_data_t data;
+    uint64_t interval;
+    /*expiries since the last epoll_timer_read or arm*/
+    uint64_t expirations;
+    int fd;
+    /*link on the instance fired list*/
+    char fired;
+    struct _epoll_timer* prev;
+    struct _epoll_timer* next;
+}epoll_timer, *pepoll_timer;
+
+#ifndef EPOLL_NO_STATS
+/*
+ * one shard of an instance's epoll_stats counters. A thread always updates
+ * the same shard, so the relaxed adds stay on lines no other thread
+ * writes unless more threads than shards use the instance.
+ */
+typedef struct _epoll_statshard {
+    std::atomic<uint64_t> waits;
+    std::atomic<uint64_t> events;
+    std::atomic<uint64_t> completions;
+    std::atomic<uint64_t> filtered;
+    std::atomic<uint64_t> polls;
+    std::atomic<uint64_t> rearms;
+    std::atomic<uint64_t> cancels;
+    std::atomic<uint64_t> contended;
+    std::atomic<uint64_t> contention_ns;
+    std::atomic<uint64_t> spins;
+    std::atomic<uint64_t> spinhits;
+    std::atomic<uint64_t> steals;
+    std::atomic<uint64_t> probes;
+    std::atomic<uint64_t> probehits;
+    std::atomic<uint64_t> wait_hist[EPOLL_STATS_BUCKETS];
+    std::atomic<uint64_t> batch_hist[EPOLL_STATS_BUCKETS];
+    /*keeps neighbouring shards off each other's cache lines*/
+    char pad[SLAB_CACHELINE];
+}epoll_statshard, *pepoll_statshard;
+
+#define EPOLL_STAT(inst, field, n) \
+    _epoll_shard(inst)->field.fetch_add((n), std::memory_order_relaxed)
+#define EPOLL_STATHIST(inst, hist, v) \
+    _epoll_shard(inst)->hist[_epoll_statbucket(v)].fetch_add(1, std::memory_order_relaxed)
+#else
+#define EPOLL_STAT(inst, field, n) ((void)(inst))
+#define EPOLL_STATHIST(inst, hist, v) ((void)(inst))
+#endif
 
-inline static int afdpoll(HANDLE pafddevhwnd, AFD_POLL_INFO* poll_info, LPOVERLAPPED ol) {
-    DWORD bytes;
-    BOOL success = DeviceIoControl(pafddevhwnd, IOCTL_AFD_POLL, poll_info, sizeof * poll_info, poll_info, sizeof * poll_info, &bytes, ol);
-    if (success == FALSE) {
-        errno = GetLastError();
-        return -1;
-    }
-    return 0;
+/*
+ * an epoll_submit_recv/send operation, owned by the backend until its
+ * completion is dequeued
+ */
+typedef struct _epoll_io {
+    /*first, a completion's poll pointer is the record*/
+    epoll_poll poll;
+    epoll_data_t data;
+    pepoll_port port;
+    uint32_t buf;
+    int send;
+    /*link on the instance list of operations in flight*/
+    struct _epoll_io* prev;
+    struct _epoll_io* next;
+}epoll_io, *pepoll_io;
+
+/*
+ * one per epoll_create, everything a wait or ctl touches is reached from
+ * here so instances never contend with each other. The struct is never
+ * freed, closed instances are kept on a free list for reuse, which lets
+ * _epoll_acquire bump refs without holding a lock.
+ */
+typedef struct _epoll_instance {
+    epoll_port port;
+    /*
+     * EPOLL_SHARDED: registrations are spread over nports completion ports,
+     * ports[0] is port. sleeping counts the waiters blocked on each.
+     */
+    epoll_port shardports[EPOLL_MAX_PORTS - 1];
+    pepoll_port ports[EPOLL_MAX_PORTS];
+    uint32_t nports;
+    std::atomic<int> sleeping[EPOLL_MAX_PORTS];
+    std::mutex lock;
+    fd_map mevents;
+    /*records whose poll has to be issued, changed or cancelled*/
+    epoll_list rearm;
+    /*edge triggered records waiting for their reader to come back*/
+    epoll_list etdeferred;
+    /*EPOLL_LAZY: level triggered records reported and not polled again yet*/
+    epoll_list ready;
+    /*deleted records whose poll the next _epoll_update_events cancels*/
+    epoll_list cancels;
+    int lazy;
+    /*records on any list, lets epoll_wait skip the lock when all are empty*/
+    std::atomic<uint32_t> queued;
+    std::atomic<uint32_t> waitseq;
+    /*
+     * epoll_info records by port, so the records of a worker's sockets
+     * share slabs on its NUMA node. The rest of the counters are under
+     * lock too.
+     */
+    slab_pool infopools[EPOLL_MAX_PORTS];
+    uint32_t pollcount;
+    uint32_t detached;
+    /*epoll_timer_create timers, fired ones wait on the list to be reported*/
+    timer_wheel wheel;
+    fd_table timerfds;
+    slab_pool timerpool;
+    pepoll_timer firedhead;
+    pepoll_timer firedtail;
+    uint32_t firedcount;
+    /*armed plus fired timers, lets epoll_wait skip the lock when there are none*/
+    std::atomic<uint32_t> timers;
+    /*steady ms a blocked epoll_wait wakes up by, UINT64_MAX when unknown*/
+    std::atomic<uint64_t> sleepuntil;
+    /*submitted operations and the buffers they use, counted in pollcount*/
+    slab_pool iopool;
+    pepoll_io iohead;
+    struct epoll_iobuf* iobufs;
+    uint32_t niobufs;
+    std::vector<uint8_t> iobusy;
+    /*epoll_setbusypoll, spinus is the budget in use (tuned when adaptive)*/
+    std::atomic<uint32_t> busyus;
+    std::atomic<uint32_t> spinus;
+    std::atomic<int> busyadaptive;
+#ifndef EPOLL_NO_STATS
+    epoll_statshard stats[EPOLL_STATS_SHARDS];
+#endif
+    std::atomic<int> epfd;
+    std::atomic<int> refs;
+    std::atomic<int> closed;
+    std::atomic<int> waiters;
+    struct _epoll_instance* nextfree;
+}epoll_instance, *pepoll_instance;
+
+/*
+ * EPOLLEXCLUSIVE registrations of one base socket across instances. Only
+ * the holder has a poll issued, so a readiness change completes on a
+ * single port and wakes one waiter instead of one per instance.
+ */
+typedef struct _epoll_xgroup {
+    std::mutex lock;
+    uint64_t socket;
+    std::vector<pepoll_info> members;
+    pepoll_info holder;
+    size_t cursor;
+}epoll_xgroup, *pepoll_xgroup;
+
+/*
+ * epoll_eventfd counter. A registration's poll is armed on the object and
+ * completed with one posted entry when the counter turns readable, signals
+ * that come while that entry is pending only add to the counter. Like
+ * instances the objects are never freed, closed ones are reused once the
+ * last registration is gone, so a lookup may race a close safely.
+ */
+typedef struct _epoll_evfd {
+    std::mutex lock;
+    uint64_t count;
+    int fd;                 /* -1 once closed */
+    int refs;               /* the fd and every registration */
+    std::vector<pepoll_info> armed;
+    struct _epoll_evfd* nextfree;
+}epoll_evfd, *pepoll_evfd;
+
+/*fd -> socket (and eventfd objects on Windows)*/
+static fd_table fdtab;
+/*epfd -> epoll_instance*/
+static fd_table epfdtab;
+static std::mutex instlock;
+static pepoll_instance instfree = NULL;
+/*base socket -> exclusive group*/
+static std::mutex xlock;
+static std::unordered_map<uint64_t, pepoll_xgroup> xgroups;
+#ifdef _WIN32
+static const epoll_backend* defbackend = &epoll_backend_afd;
+#else
+static const epoll_backend* defbackend = &epoll_backend_linux;
+#endif
+/*fd -> eventfd object*/
+static fd_map evfdmap;
+static std::mutex evfdlock;
+static pepoll_evfd evfdfree = NULL;
+/*wait and lock contention counters of the calling thread*/
+static thread_local struct epoll_threadstats tstats;
+/*epoll_setworker id of the calling thread, and the node of each worker + 1*/
+static thread_local int tworker = -1;
+static std::atomic<int> workernodes[EPOLL_MAX_WORKERS];
+
+#ifndef EPOLL_NO_STATS
+static std::atomic<uint32_t> statsnext(0);
+
+static pepoll_statshard _epoll_shard(pepoll_instance inst) {
+    static thread_local uint32_t shard = statsnext++ % EPOLL_STATS_SHARDS;
+    return &inst->stats[shard];
 }
 
-inline static int afdcancelpoll(HANDLE pafddevhwnd, LPOVERLAPPED ol) {
-    BOOL success = CancelIoEx(pafddevhwnd, ol);
-    if (success == FALSE) {
-        errno = GetLastError();
-        return -1;
+/*bucket 0 holds 0, bucket b values in [2^(b-1), 2^b), the last one the rest*/
+static int _epoll_statbucket(uint64_t v) {
+    int b = 0;
+    while (v != 0 && b < EPOLL_STATS_BUCKETS - 1) {
+        v >>= 1;
+        b++;
     }
-    return 0;
+    return b;
 }
+#endif
 
-static const GUID msafd_provider_ids[3] = {
-  {0xe70f1aa0, 0xab8b, 0x11cf,
-      {0x8c, 0xa3, 0x00, 0x80, 0x5f, 0x48, 0xa1, 0x92}},
-  {0xf9eab0c0, 0x26d4, 0x11d0,
-      {0xbb, 0xbf, 0x00, 0xaa, 0x00, 0x6c, 0x34, 0xe4}},
-  {0x9fc48064, 0x7298, 0x43e4,
-      {0xb7, 0xbd, 0x18, 0x1f, 0x20, 0x89, 0x79, 0x2a}}
-};
+/*steady clock in ms, the tick of the timer wheels*/
+static uint64_t _epoll_clock() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-inline static SOCKET create_peer_socket(HANDLE iocp,
-    WSAPROTOCOL_INFOW* protocol_info) {
-    SOCKET sock = 0;
-
-    sock = WSASocketW(protocol_info->iAddressFamily,
-        protocol_info->iSocketType,
-        protocol_info->iProtocol,
-        protocol_info,
-        0,
-        WSA_FLAG_OVERLAPPED);
-    if (sock == INVALID_SOCKET) {
-        return INVALID_SOCKET;
-    }
+/*the same clock in ns, epoll_wait deadlines*/
+static uint64_t _epoll_clockns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-    if (!SetHandleInformation((HANDLE)sock, HANDLE_FLAG_INHERIT, 0)) {
-        goto error;
-    };
+/*
+ * takes an instance lock, time spent blocked on it is charged to the
+ * thread and the instance
+ */
+static void _epoll_lock(pepoll_instance inst, std::unique_lock<std::mutex>& lock1) {
+    uint64_t ns;
 
-    if (CreateIoCompletionPort((HANDLE)sock,
-        iocp,
-        (ULONG_PTR)sock,
-        0) == NULL) {
-        goto error;
-    }
+    if (lock1.try_lock())
+        return;
+    auto start = std::chrono::steady_clock::now();
+    lock1.lock();
+    ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    tstats.contended++;
+    tstats.contention_ns += ns;
+    EPOLL_STAT(inst, contended, 1);
+    EPOLL_STAT(inst, contention_ns, ns);
+}
 
-    return sock;
+/*
+ * port index for a registration or submitted operation on fd, the one of
+ * its worker or else hashed since fds can go up in steps (handle values
+ * on Windows, 4 apart)
+ */
+static uint32_t _epoll_portno(pepoll_instance inst, int fd, int worker) {
+    if (worker >= 0)
+        return (uint32_t)worker % inst->nports;
+    return (((uint32_t)fd * 0x9E3779B9U) >> 16) % inst->nports;
+}
 
-error:
-    closesocket(sock);
-    return INVALID_SOCKET;
+static pepoll_port _epoll_fdport(pepoll_instance inst, int fd) {
+    return inst->ports[_epoll_portno(inst, fd, -1)];
 }
 
-inline static SOCKET get_peer_socket(HANDLE ephwnd, WSAPROTOCOL_INFOW* protocol_info) {
-    int index, i;
+/*port for entries that should wake any waiter, one somebody blocks on*/
+static pepoll_port _epoll_wakeport(pepoll_instance inst) {
+    for (uint32_t n = 1; n < inst->nports; n++) {
+        if (inst->sleeping[n].load() > 0)
+            return inst->ports[n];
+    }
+    return &inst->port;
+}
 
-    index = -1;
-    for (i = 0; (size_t)i < 3; i++) {
-        if (memcmp((void*)&protocol_info->ProviderId,
-            (void*)&msafd_provider_ids[i],
-            sizeof protocol_info->ProviderId) == 0) {
-            index = i;
+/*
+ * dequeue from the instance ports. With one port that is the backend's
+ * dequeue, sharded the calling thread takes from its home port first and
+ * steals from the others, then blocks on the home port. A port can only
+ * be waited on by blocking on it, so unless every other port has a waiter
+ * blocked on it the block is cut to EPOLL_STEAL_MS to look again.
+ */
+static int _epoll_dequeue(pepoll_instance inst, pepoll_completion out, uint32_t max, int timeout) {
+    static std::atomic<uint32_t> homenext(0);
+    static thread_local uint32_t homeseq = homenext++;
+    uint32_t home = (tworker >= 0 ? (uint32_t)tworker : homeseq) % inst->nports;
+    uint32_t p;
+    uint64_t until = timeout > 0 ? _epoll_clock() + (uint64_t)timeout : 0;
+    uint64_t now;
+    uint32_t n;
+    int count;
+    int slice;
+
+    if (inst->nports == 1)
+        return inst->port.backend->dequeue(&inst->port, out, max, timeout);
+
+    /*
+     * counted as blocked for the whole call, a wakeup posted meanwhile
+     * comes here or is seen below. A port somebody waits on is left to
+     * its waiter.
+     */
+    inst->sleeping[home]++;
+    for (;;) {
+        count = 0;
+        for (n = 0; n < inst->nports; n++) {
+            p = (home + n) % inst->nports;
+            if (n > 0 && inst->sleeping[p].load() > 0)
+                continue;
+            count = inst->port.backend->dequeue(inst->ports[p], out, max, 0);
+            if (count != 0)
+                break;
         }
-    }
+        if (count > 0 && n > 0)
+            EPOLL_STAT(inst, steals, 1);
+        if (count != 0 || timeout == 0)
+            break;
 
-    if (index < 0) {
-        return INVALID_SOCKET;
+        for (n = 1; n < inst->nports; n++) {
+            if (inst->sleeping[(home + n) % inst->nports].load() == 0)
+                break;
+        }
+        slice = n < inst->nports ? EPOLL_STEAL_MS : EPOLL_PARK_MS;
+        if (timeout > 0) {
+            now = _epoll_clock();
+            if (now >= until)
+                break;
+            if (until - now < (uint64_t)slice)
+                slice = (int)(until - now);
+        }
+        count = inst->port.backend->dequeue(inst->ports[home], out, max, slice);
+        if (count != 0)
+            break;
     }
-
-    return create_peer_socket(ephwnd, protocol_info);
+    inst->sleeping[home]--;
+    return count;
 }
 #endif
 
-static int closed = 0;
-
 int epoll_sock2fd(socket_t s) {
 #ifdef _WIN32
-    std::map<socket_t, int>::iterator iter;
-    std::map<int, socket_t>::iterator iter2;
-
-    std::lock_guard<std::recursive_mutex> lock1(m1);
-    
-    iter = msock2fd.find(s);
-    if (iter != msock2fd.end())
-        return iter->second;
-   
-    for (;;) {
-        ++fdctr;
-        if (fdctr > EPOLL_MAX_FD)
-            fdctr = 1;
-        iter2 = mfd2sock.find(fdctr);
-        if (iter2 == mfd2sock.end())
-            break;
-    }
-
-    msock2fd.insert(std::pair<socket_t, int>(s, fdctr));
-    mfd2sock.insert(std::pair<int, socket_t>(fdctr, s));
-
-    return fdctr;
+    int fd = fdtable_insert(&fdtab, (uint64_t)s, NULL);
+    if (fd < 0)
+        errno = EMFILE;
+    return fd;
 #else
     return s;
 #endif
 }
 
-socket_t epoll_fd2sock(int fd) {
+int epoll_handle2fd(uintptr_t handle, int type) {
+    if (type < EPOLL_HANDLE_SOCKET || type > EPOLL_HANDLE_FILE) {
+        errno = EINVAL;
+        return -1;
+    }
 #ifdef _WIN32
-    std::map<int, socket_t>::iterator iter;
-    std::lock_guard<std::recursive_mutex> lock1(m1);
-    iter = mfd2sock.find(fd);
-    if (iter != mfd2sock.end())
-        return iter->second;
-    return INVALID_SOCKET;
-#else
+    int fd = fdtable_inserttype(&fdtab, (uint64_t)handle, (uint32_t)type, NULL);
+    if (fd < 0)
+        errno = EMFILE;
     return fd;
+#else
+    return (int)handle;
 #endif
 }
 
-void epoll_postqueued(int epfd) {
+socket_t epoll_fd2sock(int fd) {
 #ifdef _WIN32
-    std::lock_guard<std::recursive_mutex> lock1(m1);
-    closed = 1;
-    PostQueuedCompletionStatus(mfd2hwnd[epfd], 0, 0, NULL);
+    uint64_t s;
+    if (fdtable_lookup(&fdtab, fd, &s, NULL) < 0)
+        return INVALID_SOCKET;
+    return (socket_t)s;
+#else
+    return fd;
 #endif
 }
 
+int epoll_freefd(int fd) {
 #ifdef _WIN32
-
-static void _delefd(int fd) {
-    std::map<int, pepoll_info>::iterator iter;
-    iter = mevents.find(fd);
-    if (iter != mevents.end()) {
-        free(iter->second);
-        mevents.erase(iter);
+    if (fdtable_free(&fdtab, fd) < 0) {
+        errno = EBADF;
+        return -1;
     }
+    return 0;
+#else
+    (void)fd;
+    return 0;
+#endif
 }
 
-static int _existefd(int fd) {
-    std::map<int, pepoll_info>::iterator iter;
-    iter = mevents.find(fd);
-    if (iter != mevents.end())
-        return 1;
+#ifdef EPOLL_EMULATION
+
+/*socket behind fd, on Linux the fds handed to epoll_ctl are the sockets*/
+static int _epoll_fdhandle(int fd, uint64_t* handle) {
+#ifdef _WIN32
+    return fdtable_lookup(&fdtab, fd, handle, NULL);
+#else
+    if (fd <= 0)
+        return -1;
+    *handle = (uint64_t)fd;
     return 0;
+#endif
 }
 
-static int _existepfd(int epfd) {
-    std::map<int, HANDLE>::iterator iter;
-    iter = mfd2hwnd.find(epfd);
-    if (iter != mfd2hwnd.end())
-        return 1;
-    return 0;
+/*EPOLL_HANDLE_* of fd, on Linux only regular files need telling apart*/
+static int _epoll_fdtype(int fd) {
+#ifdef _WIN32
+    int type = fdtable_type(&fdtab, fd);
+    return type < 0 ? EPOLL_HANDLE_SOCKET : type;
+#else
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        return EPOLL_HANDLE_FILE;
+    return EPOLL_HANDLE_SOCKET;
+#endif
 }
 
-void close(int epfd) {
-    std::lock_guard<std::recursive_mutex> lock1(m1);
-    if (mfd2hwnd[epfd] == NULL)
-        return;
-    CloseHandle(mfd2hwnd[epfd]);
-    mfd2hwnd.clear();
-    mfd2sock.clear();
-    msock2fd.clear();
-    closed = 1;
-    std::map<int, pepoll_info>::iterator iter;
-    for (iter = mevents.begin(); iter != mevents.end(); iter++) {
-        free(iter->second);
-    }
-    mevents.clear();
-    mevents_copy.clear();
+/*
+ * cheap socket check for the submit path, the type is in the fd table on
+ * Windows; on Linux the backend's recv/send turns others away itself
+ */
+static int _epoll_issocket(int fd) {
+#ifdef _WIN32
+    return fdtable_type(&fdtab, fd) == EPOLL_HANDLE_SOCKET;
+#else
+    (void)fd;
+    return 1;
+#endif
 }
 
-static int _epollreqpoll(int fd, pepoll_info epoll_info) {
+static void _epoll_sethandle(int fd, uint64_t handle) {
+#ifdef _WIN32
+    fdtable_sethandle(&fdtab, fd, handle);
+#else
+    (void)fd;
+    (void)handle;
+#endif
+}
 
-    assert(epoll_info != NULL);
-    epoll_info->pollinfo.Exclusive = FALSE;
-    epoll_info->pollinfo.NumberOfHandles = 1;
-    epoll_info->pollinfo.Timeout.QuadPart = INT64_MAX;
-    epoll_info->pollinfo.Handles[0].Handle = (HANDLE)epoll_info->socket;
-    epoll_info->pollinfo.Handles[0].Status = 0;
-    epoll_info->pollinfo.Handles[0].Events = epoll_info->epollevent.events;
-
-    if (afdpoll((HANDLE)epoll_info->peer_socket, &epoll_info->pollinfo, &epoll_info->ol) < 0) {
-        switch (errno) {
-        case ERROR_IO_PENDING:
+/*
+ * moves the exclusive poll to the next member and posts it the token,
+ * members whose instance has a thread blocked in epoll_wait come first.
+ * With skip set (the holder that just reported) nothing changes when no
+ * other instance is waiting. caller holds g->lock.
+ */
+static void _epoll_xelect(pepoll_xgroup g, pepoll_info skip) {
+    size_t n = g->members.size();
+    size_t k, idx = 0;
+    pepoll_info member = NULL;
+
+    for (k = 0; k < n; k++) {
+        idx = (g->cursor + k) % n;
+        if (g->members[idx] != skip && g->members[idx]->inst->waiters.load() > 0) {
+            member = g->members[idx];
             break;
-        case ERROR_INVALID_HANDLE:
-            if (afdcancelpoll((HANDLE)epoll_info->peer_socket,
-                &epoll_info->ol) < 0)
-                return -1;
-            epoll_info->pollstatus = epoll_status::EPOLL_CANCELLED;
-            epoll_info->pendingevents = 0;
-            epoll_info->pendingdelete = 1;
-            return -1;
-        default:
-            return -1;
         }
     }
-    epoll_info->pollstatus = epoll_status::EPOLL_PENDING;
-    epoll_info->pendingevents = epoll_info->pollinfo.Handles[0].Events;
-    return 0;
-}
-
-static int _epoll_update_events() {
-    pepoll_info _epoll_info = NULL;
-    int fd = -1;
 
-    std::map<int, pepoll_info>::iterator iter;
+    if (member == NULL) {
+        if (skip != NULL || n == 0)
+            return;
+        idx = g->cursor % n;
+        member = g->members[idx];
+    }
 
-    std::lock_guard<std::recursive_mutex> lock1(m1);
+    g->cursor = idx + 1;
+    g->holder = member;
+    member->inst->port.backend->post(_epoll_wakeport(member->inst), NULL, EPOLL_XTOKEN_KEY, (uint32_t)member->fd);
+}
 
-    iter = mevents_copy.begin();
+static int _epoll_xjoin(pepoll_info _epoll_info) {
+    pepoll_xgroup g;
+    std::lock_guard<std::mutex> lock1(xlock);
+    auto it = xgroups.find(_epoll_info->poll.socket);
 
-    while(iter != mevents_copy.end()){
+    if (it != xgroups.end()) {
+        g = it->second;
+    }
+    else {
+        g = new (std::nothrow) epoll_xgroup();
+        if (g == NULL)
+            return -1;
+        g->socket = _epoll_info->poll.socket;
+        g->holder = NULL;
+        g->cursor = 0;
+        xgroups[g->socket] = g;
+    }
 
-        fd = iter->first;
-        _epoll_info = iter->second;
+    std::lock_guard<std::mutex> lock2(g->lock);
+    g->members.push_back(_epoll_info);
+    if (g->holder == NULL)
+        g->holder = _epoll_info;
+    _epoll_info->xgroup = g;
+    return 0;
+}
 
-        if (!mevents[fd]) {
-            iter = mevents_copy.erase(iter);
-            continue;
-        }
+static void _epoll_xleave(pepoll_info _epoll_info) {
+    pepoll_xgroup g = _epoll_info->xgroup;
+    int empty;
 
-        if (_epoll_info->pollstatus == epoll_status::EPOLL_PENDING &&
-            _epoll_info->pendingevents == 0) {
-            if (afdcancelpoll((HANDLE)_epoll_info->peer_socket,
-                &_epoll_info->ol) < 0) {
-                return -1;
-            }
+    if (g == NULL)
+        return;
 
-            _epoll_info->pollstatus = epoll_status::EPOLL_CANCELLED;
-            _epoll_info->pendingevents = 0;
-        }
-        else if (_epoll_info->pollstatus == epoll_status::EPOLL_CANCELLED) {
-        }
-        else if (_epoll_info->pollstatus == epoll_status::EPOLL_IDLE) {
-            if (_epollreqpoll(fd, _epoll_info) < 0) {
-                return -1;
-            }
-            iter = mevents_copy.erase(iter);
-            continue;
+    std::lock_guard<std::mutex> lock1(xlock);
+    {
+        std::lock_guard<std::mutex> lock2(g->lock);
+        g->members.erase(std::find(g->members.begin(), g->members.end(), _epoll_info));
+        if (g->holder == _epoll_info) {
+            g->holder = NULL;
+            _epoll_xelect(g, NULL);
         }
+        empty = g->members.empty();
+    }
 
-        iter++;
+    _epoll_info->xgroup = NULL;
+    if (empty) {
+        xgroups.erase(g->socket);
+        delete g;
     }
+}
 
-    return 0;
+static int _epoll_xholder(pepoll_info _epoll_info) {
+    std::lock_guard<std::mutex> lock1(_epoll_info->xgroup->lock);
+    return _epoll_info->xgroup->holder == _epoll_info;
 }
 
+/*
+ * called after the holder reported an event so back to back events fan
+ * out over the waiting instances, returns 1 if _epoll_info keeps the poll.
+ */
+static int _epoll_xpass(pepoll_info _epoll_info) {
+    pepoll_xgroup g = _epoll_info->xgroup;
+    std::lock_guard<std::mutex> lock1(g->lock);
 
-int epoll_create(int size) {
-	if (!size)
-		return -1;
-	HANDLE phwnd = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
-    std::lock_guard<std::recursive_mutex> lock1(m1);
-    mfd2hwnd.insert(std::pair<int, HANDLE>(++epfdctr, phwnd));
-    return epfdctr;
+    if (g->holder != _epoll_info)
+        return 0;
+    _epoll_xelect(g, _epoll_info);
+    return g->holder == _epoll_info;
 }
 
-int epoll_create1(int flags) {
-	return epoll_create(1);
+/*eventfd behind fd, locked, or NULL*/
+static pepoll_evfd _epoll_evfdget(int fd, std::unique_lock<std::mutex>& lock1) {
+    pepoll_evfd e = (pepoll_evfd)fdmap_get(&evfdmap, fd);
+
+    if (e == NULL)
+        return NULL;
+    lock1 = std::unique_lock<std::mutex>(e->lock);
+    if (e->fd != fd) {
+        lock1.unlock();
+        return NULL;
+    }
+    return e;
 }
 
-int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+static void _epoll_evfdput(pepoll_evfd e) {
+    std::lock_guard<std::mutex> lock1(evfdlock);
+    e->nextfree = evfdfree;
+    evfdfree = e;
+}
 
-    SOCKET s = epoll_fd2sock(fd);
-    SOCKET peer_socket = INVALID_SOCKET;
-    pepoll_info _epoll_info = NULL;
-    WSAPROTOCOL_INFOW protocol_info;
-    int len;
-    SOCKET basesocket = INVALID_SOCKET;
-    DWORD returnbytes;
+/*readiness of the counter as AFD bits. caller holds e->lock*/
+static uint32_t _epoll_evfdready(pepoll_evfd e) {
+    if (e->fd < 0)
+        return AFD_POLL_LOCAL_CLOSE;
+    return (e->count > 0 ? EPOLLIN : 0) | (e->count < EPOLL_EVFD_MAX ? EPOLLOUT : 0);
+}
 
-    if (s == INVALID_SOCKET) {
-        errno = EBADF;
-        return -1;
+/*completes the armed polls the counter now satisfies. caller holds e->lock*/
+static void _epoll_evfdcomplete(pepoll_evfd e) {
+    uint32_t ready = _epoll_evfdready(e);
+    uint32_t fired;
+    size_t n = 0;
+
+    while (n < e->armed.size()) {
+        pepoll_info _epoll_info = e->armed[n];
+        fired = _epoll_info->evfdevents & ready;
+        if (e->fd < 0)
+            fired = ready;
+        if (fired == 0) {
+            n++;
+            continue;
+        }
+        e->armed[n] = e->armed.back();
+        e->armed.pop_back();
+        _epoll_info->evfdarmed = 0;
+        _epoll_info->port->backend->post(_epoll_info->port, &_epoll_info->poll, EPOLL_EVFD_KEY, fired);
     }
+}
 
-    if (!_existepfd(epfd) || (event == NULL && EPOLL_CTL_DEL != op)) {
-        errno = EINVAL;
-        return -1;
+/*
+ * backend calls for a record, eventfd and regular file registrations are
+ * served here with the same one completion per poll contract
+ */
+static int _epoll_attachpoll(pepoll_instance inst, pepoll_info _epoll_info, int fd, uint64_t s, int type) {
+    std::unique_lock<std::mutex> lock1;
+    pepoll_evfd e = _epoll_evfdget(fd, lock1);
+
+    _epoll_info->port = inst->ports[_epoll_info->portno];
+    if (e == NULL && type == EPOLL_HANDLE_FILE) {
+        _epoll_info->file = 1;
+        _epoll_info->poll.socket = s;
+        return 0;
     }
+    if (e == NULL) {
+        _epoll_info->poll.type = (uint32_t)type;
+        return inst->port.backend->attach(_epoll_info->port, &_epoll_info->poll, s);
+    }
+    e->refs++;
+    _epoll_info->evfd = e;
+    _epoll_info->poll.socket = s;
+    return 0;
+}
 
-    switch (op) {
-
-    case EPOLL_CTL_DEL:
-        if (!_existefd(fd)) {
-            errno = ENOENT;
-            return -1;
-        }
-        _delefd(fd);
-        break;
-
-    case EPOLL_CTL_MOD:
-        if (!_existefd(fd)) {
-            errno = ENOENT;
-            return -1;
-        }
-        _epoll_info = mevents[fd];
-        if (_epoll_info == NULL) {
-            errno = EINVAL;
-            return -1;
-        }
-        memcpy(&_epoll_info->epollevent, event, sizeof(_epoll_info->epollevent));
-        break;
+static void _epoll_detachpoll(pepoll_instance inst, pepoll_info _epoll_info) {
+    pepoll_evfd e = _epoll_info->evfd;
+    int refs;
 
-    case EPOLL_CTL_ADD:
+    if (_epoll_info->file)
+        return;
+    if (e == NULL) {
+        inst->port.backend->detach(_epoll_info->port, &_epoll_info->poll);
+        return;
+    }
     {
-        if (_existefd(fd)) {
-            errno = EEXIST;
-            return -1;
-        }
+        std::lock_guard<std::mutex> lock1(e->lock);
+        refs = --e->refs;
+    }
+    _epoll_info->evfd = NULL;
+    if (refs == 0)
+        _epoll_evfdput(e);
+}
 
-        _epoll_info = (pepoll_info)calloc(1, sizeof(epoll_info));
+static int _epoll_issuepoll(pepoll_instance inst, pepoll_info _epoll_info, uint32_t events) {
+    pepoll_evfd e = _epoll_info->evfd;
+    uint32_t ready;
 
-        if (_epoll_info == NULL) {
-            errno = ENOMEM;
-            return -1;
-        }
+    if (_epoll_info->file) {
+        /*nothing but in and out ever becomes ready, held like an armed eventfd*/
+        ready = events & (EPOLLIN | EPOLLOUT);
+        if (ready != 0)
+            return inst->port.backend->post(_epoll_info->port, &_epoll_info->poll, EPOLL_EVFD_KEY, ready);
+        _epoll_info->evfdarmed = 1;
+        return 0;
+    }
+    if (e == NULL)
+        return inst->port.backend->poll(_epoll_info->port, &_epoll_info->poll, events);
+
+    std::lock_guard<std::mutex> lock1(e->lock);
+    if (e->fd < 0)
+        return EPOLL_POLL_GONE;
+    ready = _epoll_evfdready(e) & events;
+    if (ready != 0)
+        return inst->port.backend->post(_epoll_info->port, &_epoll_info->poll, EPOLL_EVFD_KEY, ready);
+    _epoll_info->evfdevents = events;
+    _epoll_info->evfdarmed = 1;
+    e->armed.push_back(_epoll_info);
+    return 0;
+}
 
-        if (WSAIoctl(s, SIO_BASE_HANDLE, NULL, NULL, &basesocket, sizeof(basesocket), &returnbytes, NULL, NULL) == SOCKET_ERROR) {
-            errno = WSAGetLastError();
-            return -1;
+static int _epoll_cancelpoll(pepoll_instance inst, pepoll_info _epoll_info) {
+    pepoll_evfd e = _epoll_info->evfd;
+
+    EPOLL_STAT(inst, cancels, 1);
+    if (e != NULL) {
+        /*a completion already posted arrives as the cancelled one*/
+        std::lock_guard<std::mutex> lock1(e->lock);
+        if (_epoll_info->evfdarmed) {
+            e->armed.erase(std::find(e->armed.begin(), e->armed.end(), _epoll_info));
+            _epoll_info->evfdarmed = 0;
+            inst->port.backend->post(_epoll_info->port, &_epoll_info->poll, EPOLL_EVFD_KEY, 0);
         }
-
-        if (s != basesocket) {
-            mfd2sock[fd] = basesocket;
+    }
+    else if (_epoll_info->file) {
+        if (_epoll_info->evfdarmed) {
+            _epoll_info->evfdarmed = 0;
+            inst->port.backend->post(_epoll_info->port, &_epoll_info->poll, EPOLL_EVFD_KEY, 0);
         }
+    }
+    else if (inst->port.backend->cancel(_epoll_info->port, &_epoll_info->poll) < 0)
+        return -1;
+    _epoll_info->pollstatus = epoll_status::EPOLL_CANCELLED;
+    return 0;
+}
 
-        s = basesocket;
-
-        len = sizeof protocol_info;
-        if (getsockopt(s,
-            SOL_SOCKET,
-            SO_PROTOCOL_INFOW,
-            (char*)&protocol_info,
-            &len) != 0) {
-            return -1;
-        }
+static void _epoll_cancelinfo(void* data, void* arg) {
+    pepoll_instance inst = (pepoll_instance)arg;
+    pepoll_info _epoll_info = (pepoll_info)data;
 
-        peer_socket = get_peer_socket(mfd2hwnd[epfd], &protocol_info);
+    _epoll_xleave(_epoll_info);
+    if (_epoll_info->pollstatus == epoll_status::EPOLL_IDLE)
+        _epoll_detachpoll(inst, _epoll_info);
+    else if (_epoll_info->pollstatus == epoll_status::EPOLL_PENDING)
+        _epoll_cancelpoll(inst, _epoll_info);
+}
 
-        if (peer_socket == INVALID_SOCKET) {
-            if (!SetHandleInformation((HANDLE)s, HANDLE_FLAG_INHERIT, 0)) {
-                return -1;
-            };
-            if (CreateIoCompletionPort((HANDLE)s,
-                mfd2hwnd[epfd],
-                (ULONG_PTR)s,
-                0) == NULL) {
-                return -1;
+static void _epoll_destroy(pepoll_instance inst) {
+    epoll_completion entries[64];
+    uint32_t p;
+    int count, n;
+
+    fdmap_clear(&inst->mevents, _epoll_cancelinfo, inst);
+    for (pepoll_info _epoll_info = inst->cancels.head; _epoll_info != NULL; _epoll_info = _epoll_info->next)
+        _epoll_cancelpoll(inst, _epoll_info);
+    inst->cancels.head = inst->cancels.tail = NULL;
+    inst->rearm.head = inst->rearm.tail = NULL;
+    inst->etdeferred.head = inst->etdeferred.tail = NULL;
+    inst->ready.head = inst->ready.tail = NULL;
+    inst->queued = 0;
+    for (pepoll_io io = inst->iohead; io != NULL; io = io->next)
+        inst->port.backend->cancel(io->port, &io->poll);
+
+    /*the kernel owns a record until its poll completes, wait for all of them*/
+    while (inst->pollcount > 0) {
+        count = _epoll_dequeue(inst, entries, 64, EPOLL_DRAIN_TIMEOUT);
+        if (count <= 0)
+            break;
+        for (n = 0; n < count; n++) {
+            if (entries[n].key == EPOLL_IO_KEY)
+                inst->pollcount--;
+            else if (entries[n].poll != NULL) {
+                _epoll_detachpoll(inst, (pepoll_info)entries[n].poll);
+                inst->pollcount--;
             }
-            peer_socket = s;
         }
-
-        _epoll_info->pendingdelete = 0;
-        _epoll_info->socket = s;
-        _epoll_info->peer_socket = peer_socket;
-        _epoll_info->pollstatus = epoll_status::EPOLL_IDLE;
-        _epoll_info->pendingevents = 0;
-        memcpy(&_epoll_info->epollevent, event, sizeof(_epoll_info->epollevent));
-        mevents.insert(std::pair<int, pepoll_info>(fd, _epoll_info));
-        mevents_copy.insert(std::pair<int, pepoll_info>(fd, _epoll_info));
-        _epoll_update_events();
     }
-        break;
 
-    default:
-        errno = EINVAL;
-        return -1;
+    /*polls that never completed keep their slabs, leaking beats a late write*/
+    if (inst->pollcount == 0) {
+        for (p = 0; p < EPOLL_MAX_PORTS; p++)
+            slab_destroy(&inst->infopools[p]);
+        slab_destroy(&inst->iopool);
     }
+    inst->iohead = NULL;
+    inst->iobufs = NULL;
+    inst->niobufs = 0;
+    inst->iobusy.clear();
+    inst->pollcount = 0;
+    inst->detached = 0;
+
+    fdtable_destroy(&inst->timerfds);
+    slab_destroy(&inst->timerpool);
+    inst->firedhead = inst->firedtail = NULL;
+    inst->firedcount = 0;
+    inst->timers = 0;
+
+    for (p = 0; p < inst->nports; p++) {
+        if (inst->ports[p]->handle != NULL)
+            inst->port.backend->destroy(inst->ports[p]);
+    }
+    inst->nports = 0;
 
-    return 0;
+    std::lock_guard<std::mutex> lock1(instlock);
+    inst->nextfree = instfree;
+    instfree = inst;
 }
 
-int epoll_wait(int epfd, struct epoll_event* events,
-	int maxevents, int timeout) {
+static pepoll_instance _epoll_acquire(int epfd) {
+    pepoll_instance inst;
+    void* data = NULL;
+    int refs;
+
+    if (fdtable_lookup(&epfdtab, epfd, NULL, &data) < 0)
+        return NULL;
+
+    inst = (pepoll_instance)data;
+    refs = inst->refs.load();
+    do {
+        if (refs == 0)
+            return NULL;
+    } while (!inst->refs.compare_exchange_weak(refs, refs + 1));
+
+    /*the instance may have been closed and handed to a new epfd meanwhile*/
+    if (inst->epfd.load() != epfd) {
+        if (inst->refs.fetch_sub(1) == 1)
+            _epoll_destroy(inst);
+        return NULL;
+    }
 
-    ULONG notificationCount;
-    OVERLAPPED_ENTRY notification[256];
-    pepoll_info _epoll_info = NULL;
-    AFD_POLL_INFO* _poll_info = NULL;
-    uint32_t epoll_events = 0;
+    return inst;
+}
 
-    if (!mfd2hwnd[epfd]) {
-        errno = EINVAL;
-        return -1;
-    }
+static void _epoll_release(pepoll_instance inst) {
+    if (inst->refs.fetch_sub(1) == 1)
+        _epoll_destroy(inst);
+}
 
-    if (closed != 0) {
-        return 0;
-    }
+static pepoll_info _getefd(pepoll_instance inst, int fd) {
+    pepoll_info _epoll_info = (pepoll_info)fdmap_get(&inst->mevents, fd);
+    if (_epoll_info == NULL || _epoll_info->fd != fd)
+        return NULL;
+    return _epoll_info;
+}
 
-    if (events == NULL) {
-        errno = EFAULT;
-        return -1;
-    }
+static void _epoll_unqueue(pepoll_info _epoll_info) {
+    pepoll_list list = _epoll_info->list;
+    if (list == NULL)
+        return;
+    if (_epoll_info->prev != NULL)
+        _epoll_info->prev->next = _epoll_info->next;
+    else
+        list->head = _epoll_info->next;
+    if (_epoll_info->next != NULL)
+        _epoll_info->next->prev = _epoll_info->prev;
+    else
+        list->tail = _epoll_info->prev;
+    _epoll_info->prev = _epoll_info->next = NULL;
+    _epoll_info->list = NULL;
+    _epoll_info->inst->queued--;
+}
 
-    if (maxevents < 1) {
-        errno = EINVAL;
-        return -1;
-    }
+static void _epoll_enqueue(pepoll_list list, pepoll_info _epoll_info) {
+    if (_epoll_info->list == list)
+        return;
+    _epoll_unqueue(_epoll_info);
+    _epoll_info->inst->queued++;
+    _epoll_info->list = list;
+    _epoll_info->next = NULL;
+    _epoll_info->prev = list->tail;
+    if (list->tail != NULL)
+        list->tail->next = _epoll_info;
+    else
+        list->head = _epoll_info;
+    list->tail = _epoll_info;
+}
 
-    if (maxevents > 256) {
-        maxevents = 256;
-    }
+static void _epoll_queue_rearm(pepoll_instance inst, pepoll_info _epoll_info) {
+    epoll_et_release(&_epoll_info->et);
+    _epoll_enqueue(&inst->rearm, _epoll_info);
+}
 
-    if (_epoll_update_events() < 0) {
-        return -1;
+/*
+ * hands edge triggered records back to the rearm list once the waiter
+ * they were reported to calls epoll_wait again. caller holds inst->lock.
+ */
+static void _epoll_release_deferred(pepoll_instance inst, const void* waiter) {
+    pepoll_info _epoll_info = inst->etdeferred.head;
+    pepoll_info next;
+
+    for (; _epoll_info != NULL; _epoll_info = next) {
+        next = _epoll_info->next;
+        if (epoll_et_releasable(&_epoll_info->et, waiter, inst->waitseq.load()))
+            _epoll_queue_rearm(inst, _epoll_info);
     }
+}
 
-    BOOL bsuccess = GetQueuedCompletionStatusEx(mfd2hwnd[epfd], notification, maxevents, &notificationCount, timeout, false);
+static void _delefd(pepoll_instance inst, int fd) {
+    pepoll_info _epoll_info = _getefd(inst, fd);
+    if (_epoll_info == NULL)
+        return;
 
-    if (bsuccess != TRUE) {
-        if (GetLastError() == WAIT_TIMEOUT)
-            return 0;
-        errno = EINVAL;
-        return -1;
-    }
+    fdmap_set(&inst->mevents, fd, NULL);
+    _epoll_unqueue(_epoll_info);
+    _epoll_xleave(_epoll_info);
 
-    std::lock_guard<std::recursive_mutex> lock1(m1);
+    if (_epoll_info->pollstatus == epoll_status::EPOLL_IDLE) {
+        _epoll_detachpoll(inst, _epoll_info);
+        slab_free(&inst->infopools[_epoll_info->portno], _epoll_info);
+        return;
+    }
 
-    if (closed != 0) {
-        return 0;
+    /*
+     * still owned by an outstanding poll, freed when its completion is
+     * dequeued. Where the backend allows, the cancel waits for the next
+     * pass over the rearm list so a run of DELs cancels together, and is
+     * not issued at all when a waiter dequeues the completion first.
+     */
+    if (_epoll_info->pollstatus == epoll_status::EPOLL_PENDING) {
+        if (inst->port.backend->latecancel)
+            _epoll_enqueue(&inst->cancels, _epoll_info);
+        else
+            _epoll_cancelpoll(inst, _epoll_info);
     }
+    _epoll_info->detached = 1;
+    inst->detached++;
+}
 
-    int i = 0;
+static int _existefd(pepoll_instance inst, int fd) {
+    return _getefd(inst, fd) != NULL;
+}
 
-    for (int n = 0; n < notificationCount; n++) {
+#endif
 
-        pepoll_info _epoll_info = (pepoll_info)notification[i].lpOverlapped;
+void epoll_postqueued(int epfd) {
+#ifdef EPOLL_EMULATION
+    pepoll_instance inst = _epoll_acquire(epfd);
+    if (inst == NULL)
+        return;
+    inst->port.backend->post(_epoll_wakeport(inst), NULL, EPOLL_WAKEUP_KEY, 0);
+    _epoll_release(inst);
+#endif
+}
 
-        _poll_info = &_epoll_info->pollinfo;
-        epoll_events = 0;
+#ifdef EPOLL_EMULATION
 
-        _epoll_info->pollstatus = epoll_status::EPOLL_IDLE;
-        _epoll_info->pendingevents = 0;
+void epoll_setbackend(const epoll_backend* backend) {
+#ifdef _WIN32
+    defbackend = backend != NULL ? backend : &epoll_backend_afd;
+#else
+    defbackend = backend != NULL ? backend : &epoll_backend_linux;
+#endif
+}
 
-        mevents_copy.insert(std::pair<int, pepoll_info>(_epoll_info->epollevent.data.fd, _epoll_info));
+int epoll_close(int epfd) {
+    pepoll_instance inst = _epoll_acquire(epfd);
+    int waiters;
+    int sleeping;
+
+    if (inst == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (fdtable_free(&epfdtab, epfd) < 0) {
+        _epoll_release(inst);
+        errno = EBADF;
+        return -1;
+    }
+
+    /*wake every blocked epoll_wait, the ports are closed with the last ref*/
+    inst->closed = 1;
+    waiters = inst->waiters.load();
+    for (uint32_t p = 1; p < inst->nports; p++) {
+        for (sleeping = inst->sleeping[p].load(); sleeping > 0 && waiters > 0; sleeping--, waiters--)
+            inst->port.backend->post(inst->ports[p], NULL, 0, 0);
+    }
+    for (; waiters > 0; waiters--)
+        inst->port.backend->post(&inst->port, NULL, 0, 0);
+
+    _epoll_release(inst);
+    _epoll_release(inst);
+    return 0;
+}
+
+#ifdef _WIN32
+void close(int epfd) {
+    epoll_close(epfd);
+}
+#endif
+
+static int _epollreqpoll(pepoll_instance inst, pepoll_info epoll_info) {
+    uint32_t events = epoll_info->epollevent.events & ~EPOLL_CTLBITS;
+
+    assert(epoll_info != NULL);
+    epoll_info->poll.exclusive = (epoll_info->epollevent.events & EPOLLEXCLUSIVE) != 0;
+
+    switch (_epoll_issuepoll(inst, epoll_info, events)) {
+    case 0:
+        break;
+    case EPOLL_POLL_GONE:
+        /*the socket is gone, no poll was queued so post the hangup ourselves*/
+        if (inst->port.backend->post(epoll_info->port, &epoll_info->poll, 0, 0) < 0)
+            return -1;
+        epoll_info->pendingdelete = 1;
+        break;
+    default:
+        return -1;
+    }
+    epoll_info->pollstatus = epoll_status::EPOLL_PENDING;
+    epoll_info->pendingevents = events;
+    inst->pollcount++;
+    EPOLL_STAT(inst, polls, 1);
+    return 0;
+}
+
+/*
+ * drains the cancel and rearm lists, cost is the number of records that
+ * changed since the last drain. caller holds inst->lock.
+ */
+static int _epoll_update_events(pepoll_instance inst) {
+    pepoll_info _epoll_info = NULL;
+    uint32_t events;
+    int ret = 0;
+
+    /*deleted since the last pass, a cancel that finds the poll completed is fine*/
+    while ((_epoll_info = inst->cancels.head) != NULL) {
+        _epoll_unqueue(_epoll_info);
+        if (_epoll_info->pollstatus == epoll_status::EPOLL_PENDING)
+            _epoll_cancelpoll(inst, _epoll_info);
+    }
+
+    while ((_epoll_info = inst->rearm.head) != NULL) {
+
+        _epoll_unqueue(_epoll_info);
+        events = _epoll_info->epollevent.events & ~EPOLL_CTLBITS;
+        EPOLL_STAT(inst, rearms, 1);
+
+        if (_epoll_info->pollstatus == epoll_status::EPOLL_PENDING) {
+            /*an outstanding poll without all wanted events is redone*/
+            if ((events & ~_epoll_info->pendingevents) == 0)
+                continue;
+            if (_epoll_cancelpoll(inst, _epoll_info) < 0) {
+                ret = -1;
+                continue;
+            }
+            _epoll_info->pendingevents = 0;
+        }
+        else if (_epoll_info->pollstatus == epoll_status::EPOLL_IDLE) {
+            /*an exclusive member without the token waits for it*/
+            if (_epoll_info->xgroup != NULL && !_epoll_xholder(_epoll_info))
+                continue;
+            if (_epollreqpoll(inst, _epoll_info) < 0)
+                ret = -1;
+        }
+    }
+
+    /*backends that gather polls issue them now*/
+    if (inst->port.backend->flush != NULL) {
+        for (uint32_t p = 0; p < inst->nports; p++)
+            inst->port.backend->flush(inst->ports[p]);
+    }
+
+    return ret;
+}
+
+
+static int _epoll_create(int size, int flags) {
+    pepoll_instance inst;
+    epoll_port port;
+    uint32_t nports = 1;
+    uint32_t reserve;
+    uint32_t p;
+
+    if (flags & EPOLL_SHARDED) {
+        nports = (uint32_t)flags >> 8;
+        if (nports == 0)
+            nports = std::thread::hardware_concurrency() / 2;
+        nports = std::max(2U, std::min(nports, (uint32_t)EPOLL_MAX_PORTS));
+    }
+
+    port.backend = defbackend;
+    port.handle = NULL;
+    port.flags = (flags & EPOLL_GROUPED) ? EPOLL_PORT_GROUPED : 0;
+    if (port.backend->create(&port) < 0)
+        return -1;
+
+    {
+        std::lock_guard<std::mutex> lock1(instlock);
+        inst = instfree;
+        if (inst != NULL)
+            instfree = inst->nextfree;
+    }
+
+    if (inst == NULL) {
+        inst = new (std::nothrow) epoll_instance();
+        if (inst == NULL) {
+            port.backend->destroy(&port);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    inst->port = port;
+    inst->ports[0] = &inst->port;
+    inst->sleeping[0] = 0;
+    for (p = 1; p < nports; p++) {
+        inst->ports[p] = &inst->shardports[p - 1];
+        *inst->ports[p] = port;
+        inst->ports[p]->handle = NULL;
+        inst->sleeping[p] = 0;
+    }
+    inst->nports = 1;
+    inst->lazy = (flags & EPOLL_LAZY) != 0;
+    inst->closed = 0;
+    inst->waiters = 0;
+    inst->nextfree = NULL;
+
+    wheel_init(&inst->wheel, _epoll_clock());
+    slab_init(&inst->timerpool, sizeof(epoll_timer), EPOLL_SLAB_RECORDS);
+    slab_init(&inst->iopool, sizeof(epoll_io), EPOLL_SLAB_RECORDS);
+#ifndef EPOLL_NO_STATS
+    /*a reused instance starts from zero*/
+    for (int n = 0; n < EPOLL_STATS_SHARDS; n++) {
+        pepoll_statshard shard = &inst->stats[n];
+        shard->waits = shard->events = shard->completions = shard->filtered = 0;
+        shard->polls = shard->rearms = shard->cancels = 0;
+        shard->contended = shard->contention_ns = 0;
+        shard->spins = shard->spinhits = shard->steals = 0;
+        shard->probes = shard->probehits = 0;
+        for (int b = 0; b < EPOLL_STATS_BUCKETS; b++)
+            shard->wait_hist[b] = shard->batch_hist[b] = 0;
+    }
+#endif
+    inst->firedhead = inst->firedtail = NULL;
+    inst->firedcount = 0;
+    inst->timers = 0;
+    inst->sleepuntil = UINT64_MAX;
+    inst->busyus = inst->spinus = 0;
+    inst->busyadaptive = 0;
+
+    /*
+     * size is the expected registration count, reserve records up front.
+     * registrations spread over the ports, so each pool gets its share.
+     */
+    for (p = 0; p < EPOLL_MAX_PORTS; p++)
+        slab_init(&inst->infopools[p], sizeof(epoll_info), EPOLL_SLAB_RECORDS);
+    reserve = size < FDTABLE_MAX_INDEX ? (uint32_t)size : FDTABLE_MAX_INDEX;
+    for (p = 0; p < nports; p++) {
+        if (slab_reserve(&inst->infopools[p], (reserve + nports - 1) / nports) < 0) {
+            _epoll_destroy(inst);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    for (; inst->nports < nports; inst->nports++) {
+        if (port.backend->create(inst->ports[inst->nports]) < 0) {
+            _epoll_destroy(inst);
+            return -1;
+        }
+    }
+
+    int epfd = fdtable_insert(&epfdtab, (uint64_t)inst, inst);
+    if (epfd < 0) {
+        _epoll_destroy(inst);
+        errno = EMFILE;
+        return -1;
+    }
+
+    inst->epfd = epfd;
+    inst->refs = 1;
+    return epfd;
+}
+
+int epoll_create(int size) {
+    if (size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return _epoll_create(size, 0);
+}
+
+int epoll_create1(int flags) {
+    return _epoll_create(1, flags);
+}
+
+/*
+ * records of a worker's sockets are allocated on the node it last called
+ * epoll_setworker from
+ */
+static void _epoll_placepool(pepoll_instance inst, uint32_t portno, int worker) {
+    int node;
+
+    if (worker < 0 || worker >= EPOLL_MAX_WORKERS)
+        return;
+    node = workernodes[worker].load(std::memory_order_relaxed) - 1;
+    if (node >= 0)
+        slab_setnode(&inst->infopools[portno], node);
+}
+
+/*
+ * one control operation, polls it needs are only queued on the rearm list.
+ * caller holds inst->lock.
+ */
+static int _epoll_ctlop(pepoll_instance inst, int op, int fd, struct epoll_event* event, int worker) {
+
+    pepoll_info _epoll_info = NULL;
+    pslab_pool pool;
+    uint32_t portno;
+    uint64_t s;
+    int type;
+    int ret = 0;
+
+    if (_epoll_fdhandle(fd, &s) < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (event == NULL && EPOLL_CTL_DEL != op) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (op) {
+
+    case EPOLL_CTL_DEL:
+        if (!_existefd(inst, fd)) {
+            errno = ENOENT;
+            ret = -1;
+            break;
+        }
+        _delefd(inst, fd);
+        break;
+
+    case EPOLL_CTL_MOD:
+        _epoll_info = _getefd(inst, fd);
+        if (_epoll_info == NULL) {
+            errno = ENOENT;
+            ret = -1;
+            break;
+        }
+        /*as on Linux an exclusive registration can only be deleted*/
+        if ((event->events | _epoll_info->epollevent.events) & EPOLLEXCLUSIVE) {
+            errno = EINVAL;
+            ret = -1;
+            break;
+        }
+        /*moving to another worker's port registers it anew there*/
+        if (worker != EPOLL_WORKER_KEEP && _epoll_portno(inst, fd, worker) != _epoll_info->portno) {
+            _delefd(inst, fd);
+            ret = _epoll_ctlop(inst, EPOLL_CTL_ADD, fd, event, worker);
+            break;
+        }
+        memcpy(&_epoll_info->epollevent, event, sizeof(_epoll_info->epollevent));
+        _epoll_queue_rearm(inst, _epoll_info);
+        break;
+
+    case EPOLL_CTL_ADD:
+    {
+        if (_existefd(inst, fd)) {
+            errno = EEXIST;
+            ret = -1;
+            break;
+        }
+
+        if ((event->events & EPOLLEXCLUSIVE) && (event->events & EPOLLONESHOT)) {
+            errno = EINVAL;
+            ret = -1;
+            break;
+        }
+
+        if (worker == EPOLL_WORKER_KEEP)
+            worker = -1;
+        portno = _epoll_portno(inst, fd, worker);
+        pool = &inst->infopools[portno];
+        _epoll_placepool(inst, portno, worker);
+        _epoll_info = (pepoll_info)slab_alloc(pool);
+
+        if (_epoll_info == NULL) {
+            errno = ENOMEM;
+            ret = -1;
+            break;
+        }
+        _epoll_info->portno = portno;
+
+        /*eventfds and files are polled by the engine and have no exclusive group*/
+        type = _epoll_fdtype(fd);
+        if ((event->events & EPOLLEXCLUSIVE) && (fdmap_get(&evfdmap, fd) != NULL || type == EPOLL_HANDLE_FILE)) {
+            slab_free(pool, _epoll_info);
+            errno = EINVAL;
+            ret = -1;
+            break;
+        }
+
+        if (_epoll_attachpoll(inst, _epoll_info, fd, s, type) < 0) {
+            slab_free(pool, _epoll_info);
+            ret = -1;
+            break;
+        }
+
+        /*remember the socket that is polled (the base socket on Windows)*/
+        if (_epoll_info->poll.socket != s)
+            _epoll_sethandle(fd, _epoll_info->poll.socket);
+
+        _epoll_info->pendingdelete = 0;
+        _epoll_info->fd = fd;
+        _epoll_info->pollstatus = epoll_status::EPOLL_IDLE;
+        _epoll_info->pendingevents = 0;
+        _epoll_info->inst = inst;
+        memcpy(&_epoll_info->epollevent, event, sizeof(_epoll_info->epollevent));
+        if ((event->events & EPOLLEXCLUSIVE) && _epoll_xjoin(_epoll_info) < 0) {
+            _epoll_detachpoll(inst, _epoll_info);
+            slab_free(pool, _epoll_info);
+            errno = ENOMEM;
+            ret = -1;
+            break;
+        }
+        if (fdmap_set(&inst->mevents, fd, _epoll_info) < 0) {
+            _epoll_xleave(_epoll_info);
+            _epoll_detachpoll(inst, _epoll_info);
+            slab_free(pool, _epoll_info);
+            errno = ENOMEM;
+            ret = -1;
+            break;
+        }
+        _epoll_queue_rearm(inst, _epoll_info);
+    }
+        break;
+
+    default:
+        errno = EINVAL;
+        ret = -1;
+        break;
+    }
+
+    return ret;
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+
+    pepoll_instance inst;
+    int ret;
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+    _epoll_lock(inst, lock1);
+
+    ret = _epoll_ctlop(inst, op, fd, event, EPOLL_WORKER_KEEP);
+    if (ret == 0 && op != EPOLL_CTL_DEL)
+        _epoll_update_events(inst);
+
+    lock1.unlock();
+    _epoll_release(inst);
+    return ret;
+}
+
+int epoll_ctl_affinity(int epfd, int op, int fd, struct epoll_event* event, int worker) {
+
+    pepoll_instance inst;
+    int ret;
+
+    if (worker < -1 || (op != EPOLL_CTL_ADD && op != EPOLL_CTL_MOD)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+    _epoll_lock(inst, lock1);
+
+    ret = _epoll_ctlop(inst, op, fd, event, worker);
+    if (ret == 0)
+        _epoll_update_events(inst);
+
+    lock1.unlock();
+    _epoll_release(inst);
+    return ret;
+}
+
+int epoll_drained(int epfd, int fd) {
+
+    pepoll_instance inst;
+    pepoll_info _epoll_info;
+    int ret = 0;
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+    _epoll_lock(inst, lock1);
+
+    /*polled by the next wait without probing it first*/
+    _epoll_info = _getefd(inst, fd);
+    if (_epoll_info == NULL) {
+        errno = ENOENT;
+        ret = -1;
+    }
+    else if (_epoll_info->list == &inst->ready)
+        _epoll_queue_rearm(inst, _epoll_info);
+
+    lock1.unlock();
+    _epoll_release(inst);
+    return ret;
+}
+
+/*the NUMA node the calling thread runs on, -1 when unknown*/
+static int _epoll_cpunode() {
+#ifdef _WIN32
+    PROCESSOR_NUMBER pn;
+    USHORT node;
+
+    GetCurrentProcessorNumberEx(&pn);
+    if (!GetNumaProcessorNodeEx(&pn, &node))
+        return -1;
+    return (int)node;
+#elif defined(__linux__)
+    unsigned cpu = 0, node = 0;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+        return -1;
+    return (int)node;
+#else
+    return -1;
+#endif
+}
+
+int epoll_setworker(int worker) {
+    if (worker < -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    tworker = worker;
+    if (worker >= 0 && worker < EPOLL_MAX_WORKERS)
+        workernodes[worker].store(_epoll_cpunode() + 1, std::memory_order_relaxed);
+    return 0;
+}
+
+int epoll_ctl_batch(int epfd, struct epoll_ctl_op* ops, int n, int* results) {
+
+    pepoll_instance inst;
+    int i, done = 0;
+
+    if (n < 0 || (n > 0 && (ops == NULL || results == NULL))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+    _epoll_lock(inst, lock1);
+
+    for (i = 0; i < n; i++) {
+        if (_epoll_ctlop(inst, ops[i].op, ops[i].fd, &ops[i].event, EPOLL_WORKER_KEEP) < 0) {
+            results[i] = errno;
+            continue;
+        }
+        results[i] = 0;
+        done++;
+    }
+    /*every ADD and MOD of the batch is armed here*/
+    _epoll_update_events(inst);
+
+    lock1.unlock();
+    _epoll_release(inst);
+    return done;
+}
+
+/*the exclusive poll was handed to fd, it is armed on the next drain*/
+static void _epoll_xtoken(pepoll_instance inst, int fd) {
+    pepoll_info _epoll_info = _getefd(inst, fd);
+    if (_epoll_info == NULL || _epoll_info->xgroup == NULL ||
+        _epoll_info->list == &inst->etdeferred)
+        return;
+    _epoll_queue_rearm(inst, _epoll_info);
+}
+
+/*
+ * a submitted operation finished, its result goes to the buffer and it is
+ * reported as EPOLLCOMPLETE. caller holds inst->lock.
+ */
+static int _epoll_iodone(pepoll_instance inst, pepoll_completion entry, struct epoll_event* event) {
+    pepoll_io io = (pepoll_io)entry->poll;
+    int reported = 0;
+
+    inst->pollcount--;
+    if (io->prev != NULL)
+        io->prev->next = io->next;
+    else
+        inst->iohead = io->next;
+    if (io->next != NULL)
+        io->next->prev = io->prev;
+
+    inst->iobufs[io->buf].len = entry->value;
+    inst->iobufs[io->buf].error = (int)entry->events;
+    inst->iobusy[io->buf] = 0;
+
+    if (inst->closed == 0) {
+        event->events = EPOLLCOMPLETE | (io->send ? EPOLLOUT : EPOLLIN);
+        event->data = io->data;
+        reported = 1;
+    }
+    slab_free(&inst->iopool, io);
+    return reported;
+}
+
+/*
+ * turns dequeued completions into epoll events, returns how many were
+ * written to events. caller holds inst->lock.
+ */
+static int _epoll_harvest(pepoll_instance inst, pepoll_completion entries, int count,
+    struct epoll_event* events, const void* waiter, int* woken) {
+
+    pepoll_info _epoll_info = NULL;
+    uint32_t epoll_events = 0;
+    int cancelled;
+    int i = 0;
+
+    for (int n = 0; n < count; n++) {
+
+        if (entries[n].key == EPOLL_IO_KEY) {
+            i += _epoll_iodone(inst, &entries[n], events + i);
+            continue;
+        }
+
+        _epoll_info = (pepoll_info)entries[n].poll;
+
+        if (_epoll_info == NULL) {
+            if (entries[n].key == EPOLL_XTOKEN_KEY)
+                _epoll_xtoken(inst, (int)entries[n].value);
+            else if (entries[n].key == EPOLL_WAKEUP_KEY)
+                *woken = 1;
+            continue;
+        }
+
+        inst->pollcount--;
+
+        if (_epoll_info->detached) {
+            /*completed before its cancel was issued*/
+            _epoll_unqueue(_epoll_info);
+            inst->detached--;
+            _epoll_detachpoll(inst, _epoll_info);
+            slab_free(&inst->infopools[_epoll_info->portno], _epoll_info);
+            continue;
+        }
+
+        /*closed meanwhile, keep the poll accounting but report nothing*/
+        if (inst->closed != 0) {
+            _epoll_info->pollstatus = epoll_status::EPOLL_IDLE;
+            continue;
+        }
+
+        epoll_events = 0;
+        cancelled = _epoll_info->pollstatus == epoll_status::EPOLL_CANCELLED;
+
+        _epoll_info->pollstatus = epoll_status::EPOLL_IDLE;
+        _epoll_info->pendingevents = 0;
 
         if (_epoll_info->pendingdelete == 1) {
             epoll_events = EPOLLHUP;
         }
-        else if (_poll_info->NumberOfHandles < 1) {
+        else if (!cancelled) {
+            epoll_events = entries[n].key == EPOLL_EVFD_KEY ? entries[n].value : entries[n].events;
+        }
+
+        epoll_events &= _epoll_info->epollevent.events;
+
+        if (epoll_events != 0 && _epoll_info->xgroup != NULL &&
+            !_epoll_xpass(_epoll_info)) {
+            /*handed to another instance, stays idle until the token is back*/
+        }
+        else if (epoll_events != 0 &&
+            (_epoll_info->epollevent.events & (EPOLLET | EPOLLONESHOT)) == EPOLLET) {
+            /*not re-armed until the reader is back, see epoll_et.h*/
+            epoll_et_latch(&_epoll_info->et, epoll_events, waiter, inst->waitseq.load());
+            _epoll_enqueue(&inst->etdeferred, _epoll_info);
+        }
+        else if (epoll_events != 0 && inst->lazy && _epoll_info->pendingdelete == 0 &&
+            _epoll_info->xgroup == NULL && _epoll_info->evfd == NULL && !_epoll_info->file &&
+            (_epoll_info->epollevent.events & (EPOLLET | EPOLLONESHOT)) == 0) {
+            /*probed by the next wait before it is polled again, see _epoll_readyprobe*/
+            _epoll_enqueue(&inst->ready, _epoll_info);
+        }
+        else if (_epoll_info->pendingdelete == 0) {
+            _epoll_queue_rearm(inst, _epoll_info);
+        }
+
+        if (epoll_events == 0)
+            continue;
+
+        if (_epoll_info->epollevent.events & EPOLLONESHOT)
+            _epoll_info->epollevent.events = AFD_POLL_LOCAL_CLOSE;
+
+        events[i].events = epoll_events;
+        events[i++].data = _epoll_info->epollevent.data;
+    }
+
+    return i;
+}
+
+/*
+ * EPOLL_LAZY: a level triggered record that was reported is most likely
+ * still ready when the next wait comes, its reader has not drained it
+ * yet. The backend probe answers that without a poll, ready ones are
+ * reported from here and stay on the list, the rest (and those passed to
+ * epoll_drained) are polled again. caller holds inst->lock.
+ */
+static int _epoll_readyprobe(pepoll_instance inst, struct epoll_event* events, int maxevents) {
+    pepoll_info last = inst->ready.tail;
+    pepoll_info _epoll_info;
+    uint32_t wanted, ready;
+    int done = 0;
+    int i = 0;
+
+    while (!done && i < maxevents && (_epoll_info = inst->ready.head) != NULL) {
+        done = _epoll_info == last;
+        wanted = _epoll_info->epollevent.events & ~EPOLL_CTLBITS;
+        ready = 0;
+        if (inst->port.backend->probe != NULL) {
+            ready = inst->port.backend->probe(_epoll_info->port, &_epoll_info->poll, wanted) & wanted;
+            EPOLL_STAT(inst, probes, 1);
+        }
+        if (ready == 0) {
+            _epoll_queue_rearm(inst, _epoll_info);
+            continue;
+        }
+        /*to the back, a short events array reports the others next time*/
+        _epoll_unqueue(_epoll_info);
+        _epoll_enqueue(&inst->ready, _epoll_info);
+        EPOLL_STAT(inst, probehits, 1);
+        events[i].events = ready;
+        events[i++].data = _epoll_info->epollevent.data;
+    }
+
+    return i;
+}
+
+static void _epoll_timersync(pepoll_instance inst) {
+    inst->timers = inst->wheel.count + inst->firedcount;
+}
+
+static void _epoll_unfire(pepoll_instance inst, pepoll_timer t) {
+    if (!t->fired)
+        return;
+    if (t->prev != NULL)
+        t->prev->next = t->next;
+    else
+        inst->firedhead = t->next;
+    if (t->next != NULL)
+        t->next->prev = t->prev;
+    else
+        inst->firedtail = t->prev;
+    t->prev = t->next = NULL;
+    t->fired = 0;
+    inst->firedcount--;
+}
+
+typedef struct _epoll_expirectx {
+    pepoll_instance inst;
+    uint64_t now;
+} epoll_expirectx, *pepoll_expirectx;
+
+static void _epoll_timerexpire(ptimer_node node, void* arg) {
+    pepoll_expirectx ctx = (pepoll_expirectx)arg;
+    pepoll_instance inst = ctx->inst;
+    pepoll_timer t = (pepoll_timer)node;
+    uint64_t missed;
+
+    t->expirations++;
+    if (t->interval != 0) {
+        /*periods the wheel was not advanced through are counted, not replayed*/
+        missed = ctx->now > t->node.expires ? (ctx->now - t->node.expires) / t->interval : 0;
+        t->expirations += missed;
+        wheel_add(&inst->wheel, &t->node, t->node.expires + (missed + 1) * t->interval);
+    }
+
+    if (t->fired)
+        return;
+    t->fired = 1;
+    t->next = NULL;
+    t->prev = inst->firedtail;
+    if (inst->firedtail != NULL)
+        inst->firedtail->next = t;
+    else
+        inst->firedhead = t;
+    inst->firedtail = t;
+    inst->firedcount++;
+}
+
+/*moves the timers due by now to the fired list. caller holds inst->lock*/
+static void _epoll_timeradvance(pepoll_instance inst) {
+    epoll_expirectx ctx;
+
+    ctx.inst = inst;
+    ctx.now = _epoll_clock();
+    wheel_advance(&inst->wheel, ctx.now, _epoll_timerexpire, &ctx);
+}
+
+/*
+ * reports fired timers as EPOLLIN, each expiry is reported once however
+ * long its count stays unread. caller holds inst->lock.
+ */
+static int _epoll_timerfire(pepoll_instance inst, struct epoll_event* events, int maxevents) {
+    pepoll_timer t;
+    int i = 0;
+
+    _epoll_timeradvance(inst);
+    while (i < maxevents && (t = inst->firedhead) != NULL) {
+        _epoll_unfire(inst, t);
+        events[i].events = EPOLLIN;
+        events[i++].data = t->data;
+    }
+    _epoll_timersync(inst);
+    return i;
+}
+
+/*
+ * shortens wait to the next timer and publishes when the wait wakes up so
+ * epoll_timer_arm knows whether it has to interrupt it. caller holds inst->lock.
+ */
+static int _epoll_timerblock(pepoll_instance inst, int wait) {
+    uint64_t next;
+
+    if (inst->firedhead != NULL)
+        return 0;
+    next = wheel_timeout(&inst->wheel);
+    if (next < (uint64_t)(wait < 0 ? INT_MAX : wait))
+        wait = (int)next;
+    inst->sleepuntil = wait < 0 ? UINT64_MAX : inst->wheel.now + (uint64_t)wait;
+    return wait;
+}
+
+static inline void _epoll_cpurelax() {
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * polls the port without blocking until the clock passes until (ns),
+ * returns what the first successful attempt dequeued or 0
+ */
+static int _epoll_spin(pepoll_instance inst, pepoll_completion out, uint32_t max, uint64_t until) {
+    int count;
+
+    do {
+        count = _epoll_dequeue(inst, out, max, 0);
+        if (count != 0)
+            return count;
+        _epoll_cpurelax();
+    } while (_epoll_clockns() < until);
+    return 0;
+}
+
+/*
+ * ms to block for on the way to deadline, -1 for none. A dequeue timeout
+ * only has ms resolution and overshoots, so a high resolution wait blocks
+ * short of the deadline by the slack and then spins up to it (spinto).
+ */
+static int _epoll_blockms(uint64_t deadline, int hires, uint64_t* spinto) {
+    uint64_t now;
+    uint64_t left;
+
+    *spinto = 0;
+    if (deadline == UINT64_MAX)
+        return -1;
+    now = _epoll_clockns();
+    if (now >= deadline)
+        return 0;
+    left = deadline - now;
+    if (!hires)
+        left += 999999;
+    else if (left < EPOLL_HIRES_SLACK_NS + 1000000) {
+        *spinto = deadline;
+        return 0;
+    }
+    else
+        left -= EPOLL_HIRES_SLACK_NS;
+    left /= 1000000;
+    return left < INT_MAX ? (int)left : INT_MAX;
+}
+
+/*
+ * adaptive busy poll, the halt polling policy: a completion that came
+ * after the spin gave up but within the configured budget doubles the
+ * spin, one that took longer (or none) halves it, a hit leaves it alone.
+ */
+static void _epoll_busytune(pepoll_instance inst, uint64_t gapus) {
+    uint32_t max = inst->busyus.load(std::memory_order_relaxed);
+    uint32_t spin = inst->spinus.load(std::memory_order_relaxed);
+
+    if (gapus <= spin)
+        return;
+    if (gapus <= max)
+        spin = spin == 0 ? EPOLL_SPIN_MIN : spin * 2;
+    else
+        spin = spin / 2 < EPOLL_SPIN_MIN ? 0 : spin / 2;
+    inst->spinus.store(spin < max ? spin : max, std::memory_order_relaxed);
+}
+
+/*
+ * the wait behind epoll_wait, epoll_pwait2 and epoll_wait_until: deadline
+ * is on the _epoll_clockns clock, UINT64_MAX blocks indefinitely
+ */
+static int _epoll_wait(int epfd, struct epoll_event* events,
+	int maxevents, uint64_t deadline, int hires) {
+
+    /*dequeue buffer reused by every wait issued from this thread*/
+    static thread_local std::vector<epoll_completion> notification;
+    /*its address identifies this thread as a waiter*/
+    static thread_local char self;
+    int notificationCount;
+    int batch;
+    pepoll_instance inst;
+    uint64_t start = _epoll_clockns();
+    int wait = deadline > start;
+    int blockms;
+    uint64_t spinto;
+    uint32_t spinus;
+    int spun = 0;
+    int woken = 0;
+    int harvested;
+    int i = 0;
+    int ret = 0;
+
+    if (events == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    if (maxevents < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    inst->waiters++;
+
+    if (inst->closed != 0) {
+        inst->waiters--;
+        _epoll_release(inst);
+        return 0;
+    }
+
+    tstats.waits++;
+    inst->waitseq++;
+
+    /*
+     * nothing to arm, release or time, skip the lock. A record another
+     * thread queues meanwhile is armed by the next wait that sees it, a
+     * timer armed meanwhile sees sleepuntil and posts a wakeup.
+     */
+    inst->sleepuntil = UINT64_MAX;
+    if (inst->queued.load() != 0 || inst->timers.load() != 0) {
+        std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+        _epoll_lock(inst, lock1);
+        if (inst->etdeferred.head != NULL)
+            _epoll_release_deferred(inst, &self);
+        if (inst->ready.head != NULL)
+            i = _epoll_readyprobe(inst, events, maxevents);
+        ret = _epoll_update_events(inst);
+        if (ret == 0 && inst->timers.load() != 0)
+            i += _epoll_timerfire(inst, events + i, maxevents - i);
+    }
+
+    if (ret < 0) {
+        inst->waiters--;
+        _epoll_release(inst);
+        return -1;
+    }
+
+    /*probed records and fired timers are returned with whatever the port already has*/
+    if (i > 0)
+        wait = 0;
+
+    /*
+     * only the first dequeue may block, after that keep pulling whatever is
+     * already queued until the caller's array is full or the port is empty
+     */
+    while (i < maxevents) {
+        batch = maxevents - i < EPOLL_WAIT_BATCH ? maxevents - i : EPOLL_WAIT_BATCH;
+        if (notification.size() < (size_t)batch)
+            notification.resize(batch);
+
+        /*a blocking dequeue ends early when a timer falls due*/
+        blockms = 0;
+        spinto = 0;
+        if (wait != 0)
+            blockms = _epoll_blockms(deadline, hires, &spinto);
+        if (blockms != 0 && inst->timers.load() != 0) {
+            std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+            _epoll_lock(inst, lock1);
+            blockms = _epoll_timerblock(inst, blockms);
+        }
+
+        /*busy polling spins before the first blocking dequeue*/
+        notificationCount = 0;
+        spinus = inst->spinus.load(std::memory_order_relaxed);
+        if (blockms != 0 && !spun && spinus != 0) {
+            spun = 1;
+            notificationCount = _epoll_spin(inst, notification.data(), (uint32_t)batch,
+                std::min<uint64_t>(_epoll_clockns() + spinus * 1000ULL, deadline));
+            EPOLL_STAT(inst, spins, 1);
+            if (notificationCount > 0)
+                EPOLL_STAT(inst, spinhits, 1);
+        }
+        if (notificationCount == 0 && blockms == 0 && spinto != 0)
+            notificationCount = _epoll_spin(inst, notification.data(), (uint32_t)batch, spinto);
+        else if (notificationCount == 0)
+            notificationCount = _epoll_dequeue(inst, notification.data(), (uint32_t)batch, blockms);
+        if (blockms != 0 && spun < 2 && inst->busyadaptive.load(std::memory_order_relaxed)) {
+            spun = 2;
+            _epoll_busytune(inst, notificationCount > 0 ? (_epoll_clockns() - start) / 1000 : UINT64_MAX);
+        }
+        if (blockms != 0)
+            inst->sleepuntil = UINT64_MAX;
+
+        if (notificationCount < 0) {
+            if (i == 0) {
+                errno = EINVAL;
+                i = -1;
+            }
+            break;
+        }
+
+        if (notificationCount > 0 || inst->timers.load() != 0) {
+            std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+            _epoll_lock(inst, lock1);
+            if (notificationCount > 0) {
+                harvested = _epoll_harvest(inst, notification.data(), notificationCount, events + i, &self, &woken);
+                EPOLL_STAT(inst, completions, notificationCount);
+                EPOLL_STAT(inst, filtered, notificationCount - harvested);
+                i += harvested;
+            }
+            if (inst->timers.load() != 0)
+                i += _epoll_timerfire(inst, events + i, maxevents - i);
+        }
+
+        /*the caller's timeout ran out*/
+        if (notificationCount == 0 && (wait == 0 || _epoll_clockns() >= deadline))
+            break;
+
+        /*
+         * the wakeup carried nothing to report (a cancelled poll, an
+         * exclusive token) or a timer or the spin cut the block short,
+         * arm what was queued and block again
+         */
+        if (i == 0 && wait != 0 && !woken && inst->closed == 0) {
+            std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+            _epoll_lock(inst, lock1);
+            _epoll_update_events(inst);
+            continue;
+        }
+
+        if (notificationCount < batch || woken || inst->closed != 0)
+            break;
+        wait = 0;
+    }
+
+    if (i > 0)
+        tstats.events += i;
+    EPOLL_STAT(inst, waits, 1);
+    EPOLL_STAT(inst, events, i > 0 ? i : 0);
+    EPOLL_STATHIST(inst, batch_hist, i > 0 ? i : 0);
+    EPOLL_STATHIST(inst, wait_hist, (_epoll_clockns() - start) / 1000);
+    inst->waiters--;
+    _epoll_release(inst);
+    return i;
+}
+
+int epoll_wait(int epfd, struct epoll_event* events,
+	int maxevents, int timeout) {
+    return _epoll_wait(epfd, events, maxevents,
+        timeout < 0 ? UINT64_MAX : _epoll_clockns() + (uint64_t)timeout * 1000000, 0);
+}
+
+int epoll_pwait2(int epfd, struct epoll_event* events,
+	int maxevents, const struct timespec* timeout, const void* sigmask) {
+    uint64_t now = _epoll_clockns();
+    uint64_t ns;
+
+    /*there are no signal masks to swap*/
+    if (sigmask != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (timeout == NULL)
+        return _epoll_wait(epfd, events, maxevents, UINT64_MAX, 1);
+
+    if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*past a few centuries is forever*/
+    ns = (uint64_t)timeout->tv_sec < (UINT64_MAX - now) / 1000000000 - 1 ?
+        (uint64_t)timeout->tv_sec * 1000000000 + (uint64_t)timeout->tv_nsec : UINT64_MAX - now;
+    return _epoll_wait(epfd, events, maxevents, now + ns, 1);
+}
+
+int epoll_wait_until(int epfd, struct epoll_event* events,
+	int maxevents, uint64_t deadline) {
+    return _epoll_wait(epfd, events, maxevents, deadline, 1);
+}
+
+uint64_t epoll_clock(void) {
+    return _epoll_clockns();
+}
+
+static pepoll_timer _epoll_gettimer(pepoll_instance inst, int tfd) {
+    void* data = NULL;
+    if (fdtable_lookup(&inst->timerfds, tfd, NULL, &data) < 0)
+        return NULL;
+    return (pepoll_timer)data;
+}
+
+/*takes the timer off the wheel and the fired list. caller holds inst->lock*/
+static void _epoll_timerreset(pepoll_instance inst, pepoll_timer t) {
+    wheel_del(&inst->wheel, &t->node);
+    _epoll_unfire(inst, t);
+    t->expirations = 0;
+    t->interval = 0;
+}
+
+int epoll_timer_create(int epfd, epoll_data_t data) {
+    pepoll_instance inst;
+    pepoll_timer t;
+    int tfd;
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+        _epoll_lock(inst, lock1);
+        t = (pepoll_timer)slab_alloc(&inst->timerpool);
+        if (t == NULL) {
+            tfd = -1;
+            errno = ENOMEM;
+        }
+        else if ((tfd = fdtable_insert(&inst->timerfds, (uint64_t)(uintptr_t)t, t)) < 0) {
+            slab_free(&inst->timerpool, t);
+            errno = EMFILE;
         }
         else {
-            epoll_events = _poll_info->Handles[0].Events;
+            wheel_nodeinit(&t->node);
+            t->data = data;
+            t->fd = tfd;
         }
+    }
 
-        epoll_events &= _epoll_info->epollevent.events;
+    _epoll_release(inst);
+    return tfd;
+}
 
-        if (epoll_events == 0)
-            continue;
+int epoll_timer_arm(int epfd, int tfd, uint64_t value, uint64_t interval) {
+    pepoll_instance inst;
+    pepoll_timer t;
+    uint64_t expires = 0;
+    int ret = 0;
 
-        if (_epoll_info->epollevent.events & EPOLLONESHOT)
-            _epoll_info->epollevent.events = AFD_POLL_LOCAL_CLOSE;
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
 
-        events[i].events = epoll_events;
-        events[i].data.u32 = _epoll_info->epollevent.data.u32;
-        events[i].data.u64 = _epoll_info->epollevent.data.u64;
-        events[i].data.ptr = _epoll_info->epollevent.data.ptr;
-        events[i++].data.fd = _epoll_info->epollevent.data.fd;
+    {
+        std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+        _epoll_lock(inst, lock1);
+        t = _epoll_gettimer(inst, tfd);
+        if (t == NULL) {
+            errno = EBADF;
+            ret = -1;
+        }
+        else {
+            _epoll_timerreset(inst, t);
+            if (value != 0) {
+                expires = _epoll_clock() + value;
+                t->interval = interval;
+                wheel_add(&inst->wheel, &t->node, expires);
+            }
+            _epoll_timersync(inst);
+            /*a blocked epoll_wait would sleep past it, make it recompute*/
+            if (value != 0 && inst->waiters.load() > 0 && expires < inst->sleepuntil.load())
+                inst->port.backend->post(_epoll_wakeport(inst), NULL, 0, 0);
+        }
     }
 
-    return i;
+    _epoll_release(inst);
+    return ret;
+}
+
+int epoll_timer_cancel(int epfd, int tfd) {
+    return epoll_timer_arm(epfd, tfd, 0, 0);
+}
+
+int epoll_timer_read(int epfd, int tfd, uint64_t* expirations) {
+    pepoll_instance inst;
+    pepoll_timer t;
+    int ret = 0;
+
+    if (expirations == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+        _epoll_lock(inst, lock1);
+        t = _epoll_gettimer(inst, tfd);
+        if (t == NULL) {
+            errno = EBADF;
+            ret = -1;
+        }
+        else {
+            _epoll_timeradvance(inst);
+            if (t->expirations == 0) {
+                errno = EAGAIN;
+                ret = -1;
+            }
+            else {
+                *expirations = t->expirations;
+                t->expirations = 0;
+                /*read before it was reported, nothing left to report*/
+                _epoll_unfire(inst, t);
+            }
+            _epoll_timersync(inst);
+        }
+    }
+
+    _epoll_release(inst);
+    return ret;
+}
+
+int epoll_timer_close(int epfd, int tfd) {
+    pepoll_instance inst;
+    pepoll_timer t;
+    int ret = 0;
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+        _epoll_lock(inst, lock1);
+        t = _epoll_gettimer(inst, tfd);
+        if (t == NULL) {
+            errno = EBADF;
+            ret = -1;
+        }
+        else {
+            _epoll_timerreset(inst, t);
+            _epoll_timersync(inst);
+            fdtable_free(&inst->timerfds, tfd);
+            slab_free(&inst->timerpool, t);
+        }
+    }
+
+    _epoll_release(inst);
+    return ret;
+}
+
+int epoll_eventfd(uint64_t initval) {
+    pepoll_evfd e;
+    int fd;
+
+    if (initval > EPOLL_EVFD_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock1(evfdlock);
+        e = evfdfree;
+        if (e != NULL)
+            evfdfree = e->nextfree;
+    }
+
+    if (e == NULL) {
+        e = new (std::nothrow) epoll_evfd();
+        if (e == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        e->fd = -1;
+    }
+
+#ifdef _WIN32
+    fd = fdtable_insert(&fdtab, (uint64_t)(uintptr_t)e, NULL);
+    if (fd < 0)
+        errno = EMFILE;
+#else
+    /*the native object only reserves the fd number*/
+    fd = eventfd(0, EFD_CLOEXEC);
+#endif
+    if (fd < 0 || fdmap_set(&evfdmap, fd, e) < 0) {
+        if (fd >= 0) {
+#ifdef _WIN32
+            fdtable_free(&fdtab, fd);
+#else
+            ::close(fd);
+#endif
+            errno = ENOMEM;
+        }
+        _epoll_evfdput(e);
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock1(e->lock);
+    e->count = initval;
+    e->refs = 1;
+    e->armed.clear();
+    e->nextfree = NULL;
+    e->fd = fd;
+    return fd;
+}
+
+int epoll_eventfd_write(int fd, uint64_t value) {
+    std::unique_lock<std::mutex> lock1;
+    pepoll_evfd e = _epoll_evfdget(fd, lock1);
+
+    if (e == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if (value > EPOLL_EVFD_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (value > EPOLL_EVFD_MAX - e->count) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    e->count += value;
+    /*registrations whose entry is still pending are not posted again*/
+    if (!e->armed.empty())
+        _epoll_evfdcomplete(e);
+    return 0;
+}
+
+int epoll_eventfd_read(int fd, uint64_t* value) {
+    std::unique_lock<std::mutex> lock1;
+    pepoll_evfd e;
+
+    if (value == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    e = _epoll_evfdget(fd, lock1);
+    if (e == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    if (e->count == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    *value = e->count;
+    e->count = 0;
+    if (!e->armed.empty())
+        _epoll_evfdcomplete(e);
+    return 0;
+}
+
+int epoll_eventfd_close(int fd) {
+    std::unique_lock<std::mutex> lock1;
+    pepoll_evfd e = _epoll_evfdget(fd, lock1);
+    int refs;
+
+    if (e == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    fdmap_set(&evfdmap, fd, NULL);
+#ifdef _WIN32
+    fdtable_free(&fdtab, fd);
+#else
+    ::close(fd);
+#endif
+    /*armed registrations complete with a local close, as sockets do*/
+    e->fd = -1;
+    _epoll_evfdcomplete(e);
+    refs = --e->refs;
+    lock1.unlock();
+
+    if (refs == 0)
+        _epoll_evfdput(e);
+    return 0;
+}
+
+int epoll_setbusypoll(int epfd, const struct epoll_busypoll* bp) {
+    pepoll_instance inst;
+
+    if (bp == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*adaptive starts at the full budget and backs off on its own*/
+    inst->busyadaptive = bp->adaptive != 0;
+    inst->busyus = bp->usecs;
+    inst->spinus = bp->usecs;
+
+    _epoll_release(inst);
+    return 0;
+}
+
+int epoll_getbusypoll(int epfd, struct epoll_busypoll* bp) {
+    pepoll_instance inst;
+
+    if (bp == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    bp->usecs = inst->busyus.load();
+    bp->adaptive = inst->busyadaptive.load();
+    bp->current = inst->spinus.load();
+
+    _epoll_release(inst);
+    return 0;
+}
+
+int epoll_register_buffers(int epfd, struct epoll_iobuf* bufs, uint32_t count) {
+    pepoll_instance inst;
+    int ret = 0;
+
+    if (count > 0 && bufs == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+        _epoll_lock(inst, lock1);
+        /*the kernel may be writing to the old ones*/
+        if (inst->iohead != NULL) {
+            errno = EBUSY;
+            ret = -1;
+        }
+        else {
+            inst->iobufs = count > 0 ? bufs : NULL;
+            inst->niobufs = count;
+            inst->iobusy.assign(count, 0);
+        }
+    }
+
+    _epoll_release(inst);
+    return ret;
+}
+
+static int _epoll_submit(int epfd, int fd, uint32_t buf, uint32_t len, int send, epoll_data_t data) {
+    pepoll_instance inst;
+    pepoll_io io;
+    uint64_t s;
+    int ret = 0;
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (inst->port.backend->submit == NULL) {
+        _epoll_release(inst);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    if (_epoll_fdhandle(fd, &s) < 0 || fdmap_get(&evfdmap, fd) != NULL || !_epoll_issocket(fd)) {
+        _epoll_release(inst);
+        errno = EBADF;
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock1(inst->lock, std::defer_lock);
+    _epoll_lock(inst, lock1);
+
+    if (buf >= inst->niobufs || (send && len > inst->iobufs[buf].size)) {
+        errno = EINVAL;
+        ret = -1;
+    }
+    else if (inst->iobusy[buf]) {
+        errno = EBUSY;
+        ret = -1;
+    }
+    else if ((io = (pepoll_io)slab_alloc(&inst->iopool)) == NULL) {
+        errno = ENOMEM;
+        ret = -1;
+    }
+    else {
+        io->data = data;
+        io->port = _epoll_fdport(inst, fd);
+        io->buf = buf;
+        io->send = send;
+        if (inst->port.backend->submit(io->port, &io->poll, s, send,
+            inst->iobufs[buf].data, send ? len : inst->iobufs[buf].size) < 0) {
+            slab_free(&inst->iopool, io);
+            ret = -1;
+        }
+        else {
+            io->prev = NULL;
+            io->next = inst->iohead;
+            if (inst->iohead != NULL)
+                inst->iohead->prev = io;
+            inst->iohead = io;
+            inst->iobusy[buf] = 1;
+            inst->pollcount++;
+        }
+    }
+
+    lock1.unlock();
+    _epoll_release(inst);
+    return ret;
+}
+
+int epoll_submit_recv(int epfd, int fd, uint32_t buf, epoll_data_t data) {
+    return _epoll_submit(epfd, fd, buf, 0, 0, data);
+}
+
+int epoll_submit_send(int epfd, int fd, uint32_t buf, uint32_t len, epoll_data_t data) {
+    return _epoll_submit(epfd, fd, buf, len, 1, data);
+}
+
+#endif
+
+#ifdef EPOLL_EMULATION
+int epoll_slabinfo(int epfd, struct epoll_slabinfo* info) {
+    pepoll_instance inst;
+
+    if (info == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock1(inst->lock);
+        info->slabs = info->capacity = info->inuse = 0;
+        for (uint32_t p = 0; p < EPOLL_MAX_PORTS; p++) {
+            info->slabs += inst->infopools[p].nslabs;
+            info->capacity += inst->infopools[p].capacity;
+            info->inuse += inst->infopools[p].inuse;
+        }
+        info->detached = inst->detached;
+    }
+
+    _epoll_release(inst);
+    return 0;
+}
+
+int epoll_handleinfo(int epfd, struct epoll_handleinfo* info) {
+    pepoll_instance inst;
+    uint32_t handles;
+    uint32_t sockets;
+
+    if (info == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock1(inst->lock);
+        info->handles = info->sockets = 0;
+        for (uint32_t p = 0; p < inst->nports; p++) {
+            inst->port.backend->handles(inst->ports[p], &handles, &sockets);
+            info->handles += handles;
+            info->sockets += sockets;
+        }
+    }
+
+    _epoll_release(inst);
+    return 0;
 }
+#endif
+
+#ifdef EPOLL_EMULATION
+int epoll_stats(int epfd, struct epoll_stats* stats) {
+#ifdef EPOLL_NO_STATS
+    (void)epfd;
+    (void)stats;
+    errno = ENOSYS;
+    return -1;
+#else
+    pepoll_instance inst;
+    pepoll_statshard shard;
+    int n, b;
+
+    if (stats == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    inst = _epoll_acquire(epfd);
+    if (inst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    for (n = 0; n < EPOLL_STATS_SHARDS; n++) {
+        shard = &inst->stats[n];
+        stats->waits += shard->waits.load(std::memory_order_relaxed);
+        stats->events += shard->events.load(std::memory_order_relaxed);
+        stats->completions += shard->completions.load(std::memory_order_relaxed);
+        stats->filtered += shard->filtered.load(std::memory_order_relaxed);
+        stats->polls += shard->polls.load(std::memory_order_relaxed);
+        stats->rearms += shard->rearms.load(std::memory_order_relaxed);
+        stats->cancels += shard->cancels.load(std::memory_order_relaxed);
+        stats->contended += shard->contended.load(std::memory_order_relaxed);
+        stats->contention_ns += shard->contention_ns.load(std::memory_order_relaxed);
+        stats->spins += shard->spins.load(std::memory_order_relaxed);
+        stats->spinhits += shard->spinhits.load(std::memory_order_relaxed);
+        stats->steals += shard->steals.load(std::memory_order_relaxed);
+        stats->probes += shard->probes.load(std::memory_order_relaxed);
+        stats->probehits += shard->probehits.load(std::memory_order_relaxed);
+        for (b = 0; b < EPOLL_STATS_BUCKETS; b++) {
+            stats->wait_hist[b] += shard->wait_hist[b].load(std::memory_order_relaxed);
+            stats->batch_hist[b] += shard->batch_hist[b].load(std::memory_order_relaxed);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock1(inst->lock);
+        stats->outstanding = inst->pollcount;
+    }
 
+    _epoll_release(inst);
+    return 0;
 #endif
+}
 
+int epoll_threadstats(struct epoll_threadstats* stats) {
+    if (stats == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+    *stats = tstats;
+    return 0;
+}
+#endif
@@ -23,18 +23,38 @@
  * SOFTWARE.
  */
 #pragma once
+#include <stdint.h>
+#include <time.h>
 #ifdef _WIN32
 #include <winsock2.h>
-#include <stdint.h>
+#define socket_t SOCKET
+/*on Windows the emulation is the only epoll there is*/
+#ifndef EPOLL_EMULATION
+#define EPOLL_EMULATION
+#endif
+#else
+#define socket_t int
+#endif
+#include "epoll_events.h"
 
-#define AFD_POLL_RECEIVE           1
-#define AFD_POLL_RECEIVE_EXPEDITED 2
-#define AFD_POLL_SEND              4
-#define AFD_POLL_DISCONNECT        8
-#define AFD_POLL_ABORT             16
-#define AFD_POLL_LOCAL_CLOSE       32
-#define AFD_POLL_ACCEPT            128
-#define AFD_POLL_CONNECT_FAIL      256
+#ifdef EPOLL_EMULATION
+
+#ifndef _WIN32
+/*
+ * built beside libc's epoll (Linux CI, profiling), the emulated entry
+ * points and types get their own names. Don't include sys/epoll.h in the
+ * same translation unit.
+ */
+#define epoll_create  emu_epoll_create
+#define epoll_create1 emu_epoll_create1
+#define epoll_ctl     emu_epoll_ctl
+#define epoll_wait    emu_epoll_wait
+#define epoll_pwait2  emu_epoll_pwait2
+#define epoll_close   emu_epoll_close
+#define epoll_data    emu_epoll_data
+#define epoll_data_t  emu_epoll_data_t
+#define epoll_event   emu_epoll_event
+#endif
 
 #define EPOLLIN      AFD_POLL_RECEIVE
 #define EPOLLPRI     AFD_POLL_RECEIVE_EXPEDITED
@@ -47,13 +67,34 @@
 #define EPOLLWRBAND  4096 // not supported yet
 #define EPOLLRDHUP   (AFD_POLL_RECEIVE | AFD_POLL_DISCONNECT | AFD_POLL_LOCAL_CLOSE)
 #define EPOLLONESHOT 512
-#define EPOLLET 1024 // not supported yet
+#define EPOLLET 1024
+#define EPOLLEXCLUSIVE (1U << 28)
+/*reported with EPOLLIN or EPOLLOUT when an epoll_submit_* operation completed*/
+#define EPOLLCOMPLETE (1U << 27)
 
 #define EPOLL_CTL_ADD 1
 #define EPOLL_CTL_MOD 2
 #define EPOLL_CTL_DEL 3
 
-#define socket_t SOCKET
+/*epoll_create1 flag, many sockets share each poll request (AFD only)*/
+#define EPOLL_GROUPED 1
+/*
+ * epoll_create1 flag, the instance spreads its sockets over several
+ * completion ports (EPOLL_SHARDS(n) picks n, at most 16, the default is
+ * half the cores). Each waiting thread takes from its home port first and
+ * steals from the others when that is empty, so waiters stop contending
+ * on one queue. Best with at least as many waiting threads as ports.
+ */
+#define EPOLL_SHARDED 2
+#define EPOLL_SHARDS(n) (EPOLL_SHARDED | ((n) << 8))
+/*
+ * epoll_create1 flag, a level triggered socket that was reported is not
+ * polled again while a cheap probe (FIONREAD on Windows, poll(2) on
+ * Linux) still finds it ready, the next epoll_wait reports it from that.
+ * Tell the instance with epoll_drained once a socket was read up to
+ * EAGAIN to skip the probe.
+ */
+#define EPOLL_LAZY 4
 
 typedef union epoll_data {
 	void* ptr;
@@ -67,18 +108,186 @@ struct epoll_event {
 	epoll_data_t data;      /* User data variable */
 };
 
+/*one operation of epoll_ctl_batch*/
+struct epoll_ctl_op {
+	int op;
+	int fd;
+	struct epoll_event event;   /* ignored for EPOLL_CTL_DEL */
+};
+
+/*
+ * a buffer of epoll_register_buffers. The engine sets len and error when
+ * an operation on it completes, it is the caller's again once reported.
+ */
+struct epoll_iobuf {
+	void* data;
+	uint32_t size;
+	uint32_t len;        /* bytes the last operation transferred, 0 at EOF */
+	int error;           /* 0 or its errno */
+};
+
+/*
+ * busy polling for latency critical waiters: a blocking epoll_wait spins
+ * on the completion port for up to usecs before it sleeps. With adaptive
+ * the spin follows the recent arrival gaps, it grows while completions
+ * come soon after it gave up and shrinks to nothing while they don't.
+ */
+struct epoll_busypoll {
+	uint32_t usecs;      /* spin budget, 0 turns busy polling off */
+	uint32_t adaptive;   /* non-zero to tune the spin up to usecs */
+	uint32_t current;    /* spin in use, filled by epoll_getbusypoll */
+};
+
+struct epoll_slabinfo {
+	uint32_t slabs;      /* slabs allocated for epoll_info records */
+	uint32_t capacity;   /* records the slabs can hold */
+	uint32_t inuse;      /* records allocated, including detached ones */
+	uint32_t detached;   /* deleted records waiting for their poll to complete */
+};
+
+struct epoll_handleinfo {
+	uint32_t handles;    /* helper handles in use (AFD peer sockets) */
+	uint32_t sockets;    /* registered sockets polled through them */
+};
+
+/*
+ * counters of one instance since epoll_create. Histogram bucket 0 counts
+ * zeros and bucket b values in [2^(b-1), 2^b), the last bucket everything
+ * above. Build with EPOLL_NO_STATS to compile them out, epoll_stats then
+ * fails with ENOSYS.
+ */
+#define EPOLL_STATS_BUCKETS 32
+
+struct epoll_stats {
+	uint64_t waits;          /* epoll_wait calls */
+	uint64_t events;         /* events they returned */
+	uint64_t completions;    /* completions they dequeued */
+	uint64_t filtered;       /* completions that reported nothing (cancelled, masked, wakeups) */
+	uint64_t polls;          /* polls issued */
+	uint64_t rearms;         /* records taken off the rearm list */
+	uint64_t cancels;        /* polls cancelled to be redone or dropped */
+	uint64_t outstanding;    /* polls and submitted operations in flight now */
+	uint64_t contended;      /* instance lock acquisitions that had to block */
+	uint64_t contention_ns;  /* time spent blocked on the instance lock */
+	uint64_t spins;          /* busy polls before blocking */
+	uint64_t spinhits;       /* those that found a completion */
+	uint64_t steals;         /* dequeues served by a port other than the waiter's home (EPOLL_SHARDED) */
+	uint64_t probes;         /* readiness probes instead of polls (EPOLL_LAZY) */
+	uint64_t probehits;      /* events they reported */
+	uint64_t wait_hist[EPOLL_STATS_BUCKETS];   /* epoll_wait duration in us */
+	uint64_t batch_hist[EPOLL_STATS_BUCKETS];  /* events per epoll_wait */
+};
+
+struct epoll_threadstats {
+	uint64_t waits;          /* epoll_wait calls */
+	uint64_t events;         /* events they returned */
+	uint64_t contended;      /* instance lock acquisitions that had to block */
+	uint64_t contention_ns;  /* time spent blocked on instance locks */
+};
+
+/*size is used as the number of epoll_info records to reserve, shared by the instance's ports*/
 int epoll_create(int size);
 int epoll_create1(int flags); 
 int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event);
+/*
+ * applies n operations under one lock and arms the polls they need in one
+ * pass. results[i] is 0 or the errno of ops[i], returns how many succeeded
+ * or -1 when the instance or arguments are invalid.
+ */
+int epoll_ctl_batch(int epfd, struct epoll_ctl_op* ops, int n, int* results);
+/*
+ * epoll_ctl ADD or MOD that puts fd on the port of worker (worker % ports
+ * of an EPOLL_SHARDED instance, -1 the default placement). A MOD that
+ * moves fd registers it anew, edge-triggered state is not kept.
+ */
+int epoll_ctl_affinity(int epfd, int op, int fd, struct epoll_event* event, int worker);
+/*
+ * makes the calling thread worker's waiter: its home port is the one of
+ * worker's sockets, other ports with a waiter of their own are not stolen
+ * from, and records of worker's sockets are allocated on the NUMA node
+ * the thread runs on now. -1 goes back to round robin homes.
+ */
+int epoll_setworker(int worker);
+/*
+ * EPOLL_LAZY hint that fd was read or written until EAGAIN, the next wait
+ * polls it without probing it first. A no-op without EPOLL_LAZY.
+ */
+int epoll_drained(int epfd, int fd);
 int epoll_wait(int epfd, struct epoll_event* events,
 	int maxevents, int timeout);
+/*
+ * epoll_wait with a ns timeout (NULL blocks). The dequeue blocks for whole
+ * ms short of the timeout and spins the rest, so sub-ms timeouts are kept
+ * to within microseconds at the cost of spinning up to ~1ms per timeout.
+ * sigmask must be NULL, there are no signal masks to swap.
+ */
+int epoll_pwait2(int epfd, struct epoll_event* events,
+	int maxevents, const struct timespec* timeout, const void* sigmask);
+/*the same, waiting until an absolute deadline in ns of epoll_clock*/
+int epoll_wait_until(int epfd, struct epoll_event* events,
+	int maxevents, uint64_t deadline);
+/*monotonic clock in ns*/
+uint64_t epoll_clock(void);
+/*
+ * timerfd-like timers owned by an epoll instance. A timer is a pseudo-fd
+ * of epfd (not a socket fd) that is reported by epoll_wait as EPOLLIN with
+ * data once per expiry batch, its count is collected with epoll_timer_read.
+ * Times are in ms on the steady clock, arm with value 0 disarms.
+ */
+int epoll_timer_create(int epfd, epoll_data_t data);
+int epoll_timer_arm(int epfd, int tfd, uint64_t value, uint64_t interval);
+int epoll_timer_cancel(int epfd, int tfd);
+/*expiries since the last read or arm, -1 with EAGAIN when there are none*/
+int epoll_timer_read(int epfd, int tfd, uint64_t* expirations);
+int epoll_timer_close(int epfd, int tfd);
+/*
+ * eventfd-like counter, a pseudo-fd for epoll_ctl that is EPOLLIN while
+ * the counter is non-zero. Writes from any thread add to it and post at
+ * most one completion per registration until that one is reported. Close
+ * it with epoll_eventfd_close, not close.
+ */
+int epoll_eventfd(uint64_t initval);
+int epoll_eventfd_write(int fd, uint64_t value);
+/*takes the whole count, -1 with EAGAIN when it is zero*/
+int epoll_eventfd_read(int fd, uint64_t* value);
+int epoll_eventfd_close(int fd);
+/*
+ * completion API beside readiness: a recv or send on one of the buffers
+ * registered with epfd is started at once (overlapped WSARecv/WSASend on
+ * Windows) and epoll_wait reports EPOLLCOMPLETE | EPOLLIN (recv) or
+ * EPOLLOUT (send) with data when it is done, no readiness round trip. A
+ * socket takes its operations from one instance, at most one operation
+ * per buffer is in flight. The buffers can only be replaced while none is.
+ */
+int epoll_setbusypoll(int epfd, const struct epoll_busypoll* bp);
+int epoll_getbusypoll(int epfd, struct epoll_busypoll* bp);
+int epoll_register_buffers(int epfd, struct epoll_iobuf* bufs, uint32_t count);
+/*receives up to bufs[buf].size bytes*/
+int epoll_submit_recv(int epfd, int fd, uint32_t buf, epoll_data_t data);
+int epoll_submit_send(int epfd, int fd, uint32_t buf, uint32_t len, epoll_data_t data);
+int epoll_slabinfo(int epfd, struct epoll_slabinfo* info);
+int epoll_handleinfo(int epfd, struct epoll_handleinfo* info);
+int epoll_stats(int epfd, struct epoll_stats* stats);
+/*counters of the calling thread, across all instances*/
+int epoll_threadstats(struct epoll_threadstats* stats);
 /*epoll cleanup*/
+int epoll_close(int epfd);
+#ifdef _WIN32
 void close(int epfd);
-#else
-#define socket_t int
+#endif
 #endif
 
 /*portable helper functions*/
 int epoll_sock2fd(socket_t s);
 socket_t epoll_fd2sock(int fd);
+/*
+ * fd of a pipe end, named pipe or file (EPOLL_HANDLE_*) to hand to
+ * epoll_ctl; on Linux it is handle itself. Windows pipes have to be opened
+ * for overlapped io, a named pipe server waiting for its client reports
+ * EPOLLIN when one connects. Pipes are always reported writable.
+ */
+int epoll_handle2fd(uintptr_t handle, int type);
+/*releases an fd returned by epoll_sock2fd or epoll_handle2fd, the socket itself is not closed*/
+int epoll_freefd(int fd);
+/*wakes one epoll_wait on epfd, it returns 0 unless it has events anyway*/
 void epoll_postqueued(int epfd);
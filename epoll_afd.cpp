@@ -0,0 +1,961 @@
+/*@file epoll_afd.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifdef _WIN32
+#include "epoll_backend.h"
+#include <winsock2.h>
+#include <bcrypt.h>
+#include <mswsock.h>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IOCTL_AFD_POLL 0x00012024
+
+typedef struct _AFD_POLL_HANDLE_INFO {
+    HANDLE Handle;
+    ULONG Events;
+    NTSTATUS Status;
+} AFD_POLL_HANDLE_INFO, * PAFD_POLL_HANDLE_INFO;
+
+typedef struct _AFD_POLL_INFO {
+    LARGE_INTEGER Timeout;
+    ULONG NumberOfHandles;
+    ULONG Exclusive;
+    AFD_POLL_HANDLE_INFO Handles[1];
+} AFD_POLL_INFO, * PAFD_POLL_INFO;
+
+/*sockets polled through one peer socket, as wepoll does*/
+#define AFD_PEER_SOCKETS 32
+#define AFD_PROVIDERS 3
+
+/*what a dequeued OVERLAPPED belongs to*/
+#define AFD_KIND_POLL  0
+#define AFD_KIND_GROUP 1
+#define AFD_KIND_IO    2      /* a submitted WSARecv/WSASend */
+#define AFD_KIND_PIPE  3      /* a zero byte read on a pipe, see _afd_pollpipe */
+
+/*afd_poll flags*/
+#define AFD_POLL_GROUPED 1      /* armed through its peer's group poll */
+#define AFD_POLL_GONE    2      /* the socket handle was found invalid */
+#define AFD_PIPE_POSTED  4      /* pipe readiness known at issue, posted as is */
+
+struct _afd_group;
+
+/*
+ * a peer socket of one msafd provider, shared by up to AFD_PEER_SOCKETS
+ * registrations and closed with the last of them. Peers that can take
+ * more are linked on their provider's avail list.
+ */
+typedef struct _afd_peer {
+    SOCKET s;
+    uint32_t refs;
+    int provider;
+    struct _afd_peer* prev;
+    struct _afd_peer* next;
+    struct _afd_group* group;   /* grouped ports only */
+} afd_peer, *pafd_peer;
+
+/*port->handle, guarded by lock as dequeue completes group polls unlocked*/
+typedef struct _afd_port {
+    HANDLE iocp;
+    int grouped;
+    std::mutex lock;
+    pafd_peer avail[AFD_PROVIDERS];
+    std::vector<struct _afd_group*> groups;
+    uint32_t peers;
+    uint32_t sockets;
+} afd_port, *pafd_port;
+
+/*the OVERLAPPED goes first, a dequeued lpOverlapped is the epoll_poll*/
+typedef struct _afd_poll {
+    OVERLAPPED ol;
+    uint32_t kind;
+    uint32_t flags;
+    AFD_POLL_INFO pollinfo;
+    union {
+        struct {
+            SOCKET peer_socket;
+            pafd_peer peer;     /* NULL when the socket is polled directly */
+        };
+        struct {
+            HANDLE event;       /* signalled by the zero byte read */
+            HANDLE wait;        /* thread pool wait posting its completion */
+            HANDLE iocp;
+        } pipe;
+    };
+} afd_poll, *pafd_poll;
+
+static_assert(sizeof(afd_poll) <= EPOLL_POLL_BLOB, "afd_poll does not fit EPOLL_POLL_BLOB");
+
+/*
+ * grouped mode (EPOLL_PORT_GROUPED): the sockets sharing a peer are polled
+ * with one variable length AFD poll. Member polls are queued on it and the
+ * ioctl is (re)issued on flush; when it completes, each reported handle
+ * becomes a member completion and the group is issued again for the rest.
+ */
+typedef struct _afd_group {
+    OVERLAPPED ol;
+    uint32_t kind;
+    int inflight;       /* group ioctl outstanding */
+    int cancelling;     /* cancelled to be reissued with new members */
+    int dirty;          /* members changed since it was issued */
+    int dead;           /* the peer lost its last registration */
+    pafd_peer peer;
+    uint32_t nmembers;
+    pafd_poll members[AFD_PEER_SOCKETS];
+    struct {
+        LARGE_INTEGER Timeout;
+        ULONG NumberOfHandles;
+        ULONG Exclusive;
+        AFD_POLL_HANDLE_INFO Handles[AFD_PEER_SOCKETS];
+    } info;
+} afd_group, *pafd_group;
+
+inline static int afdpoll(HANDLE pafddevhwnd, AFD_POLL_INFO* poll_info, DWORD size, LPOVERLAPPED ol) {
+    DWORD bytes;
+    BOOL success = DeviceIoControl(pafddevhwnd, IOCTL_AFD_POLL, poll_info, size, poll_info, size, &bytes, ol);
+    if (success == FALSE) {
+        errno = GetLastError();
+        return -1;
+    }
+    return 0;
+}
+
+inline static int afdcancelpoll(HANDLE pafddevhwnd, LPOVERLAPPED ol) {
+    BOOL success = CancelIoEx(pafddevhwnd, ol);
+    if (success == FALSE) {
+        errno = GetLastError();
+        return -1;
+    }
+    return 0;
+}
+
+static const GUID msafd_provider_ids[3] = {
+  {0xe70f1aa0, 0xab8b, 0x11cf,
+      {0x8c, 0xa3, 0x00, 0x80, 0x5f, 0x48, 0xa1, 0x92}},
+  {0xf9eab0c0, 0x26d4, 0x11d0,
+      {0xbb, 0xbf, 0x00, 0xaa, 0x00, 0x6c, 0x34, 0xe4}},
+  {0x9fc48064, 0x7298, 0x43e4,
+      {0xb7, 0xbd, 0x18, 0x1f, 0x20, 0x89, 0x79, 0x2a}}
+};
+
+inline static SOCKET create_peer_socket(HANDLE iocp,
+    WSAPROTOCOL_INFOW* protocol_info) {
+    SOCKET sock = 0;
+
+    sock = WSASocketW(protocol_info->iAddressFamily,
+        protocol_info->iSocketType,
+        protocol_info->iProtocol,
+        protocol_info,
+        0,
+        WSA_FLAG_OVERLAPPED);
+    if (sock == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    if (!SetHandleInformation((HANDLE)sock, HANDLE_FLAG_INHERIT, 0)) {
+        goto error;
+    };
+
+    if (CreateIoCompletionPort((HANDLE)sock,
+        iocp,
+        (ULONG_PTR)sock,
+        0) == NULL) {
+        goto error;
+    }
+
+    return sock;
+
+error:
+    closesocket(sock);
+    return INVALID_SOCKET;
+}
+
+static int _afd_provider(WSAPROTOCOL_INFOW* protocol_info) {
+    int i;
+
+    for (i = 0; i < AFD_PROVIDERS; i++) {
+        if (memcmp((void*)&protocol_info->ProviderId,
+            (void*)&msafd_provider_ids[i],
+            sizeof protocol_info->ProviderId) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void _afd_unavail(pafd_port aport, pafd_peer peer) {
+    if (peer->prev != NULL)
+        peer->prev->next = peer->next;
+    else if (aport->avail[peer->provider] == peer)
+        aport->avail[peer->provider] = peer->next;
+    if (peer->next != NULL)
+        peer->next->prev = peer->prev;
+    peer->prev = peer->next = NULL;
+}
+
+static void _afd_makeavail(pafd_port aport, pafd_peer peer) {
+    peer->prev = NULL;
+    peer->next = aport->avail[peer->provider];
+    if (peer->next != NULL)
+        peer->next->prev = peer;
+    aport->avail[peer->provider] = peer;
+}
+
+static void _afd_closepeer(pafd_port aport, pafd_peer peer) {
+    pafd_group g = peer->group;
+
+    if (g != NULL) {
+        aport->groups.erase(std::find(aport->groups.begin(), aport->groups.end(), g));
+        free(g);
+    }
+    closesocket(peer->s);
+    free(peer);
+    aport->peers--;
+}
+
+/*a peer socket with room for one more registration, NULL if none can be made*/
+static pafd_peer _afd_getpeer(pafd_port aport, WSAPROTOCOL_INFOW* protocol_info) {
+    int provider = _afd_provider(protocol_info);
+    pafd_peer peer;
+
+    if (provider < 0)
+        return NULL;
+
+    peer = aport->avail[provider];
+    if (peer == NULL) {
+        peer = (pafd_peer)calloc(1, sizeof(afd_peer));
+        if (peer == NULL)
+            return NULL;
+        peer->s = create_peer_socket(aport->iocp, protocol_info);
+        if (peer->s == INVALID_SOCKET) {
+            free(peer);
+            return NULL;
+        }
+        peer->provider = provider;
+        _afd_makeavail(aport, peer);
+        aport->peers++;
+    }
+
+    if (++peer->refs == AFD_PEER_SOCKETS)
+        _afd_unavail(aport, peer);
+    return peer;
+}
+
+static void _afd_putpeer(pafd_port aport, pafd_peer peer) {
+    if (peer->refs-- == AFD_PEER_SOCKETS)
+        _afd_makeavail(aport, peer);
+    if (peer->refs != 0)
+        return;
+    _afd_unavail(aport, peer);
+    /*the group ioctl still owns the peer, freed when it completes*/
+    if (peer->group != NULL && peer->group->inflight) {
+        peer->group->dead = 1;
+        afdcancelpoll((HANDLE)peer->s, &peer->group->ol);
+        return;
+    }
+    _afd_closepeer(aport, peer);
+}
+
+/*one poll of its own on the socket, 0, EPOLL_POLL_GONE or -1*/
+static int _afd_pollone(pafd_poll ap, SOCKET s, uint32_t events, int exclusive) {
+    ap->pollinfo.Exclusive = exclusive ? TRUE : FALSE;
+    ap->pollinfo.NumberOfHandles = 1;
+    ap->pollinfo.Timeout.QuadPart = INT64_MAX;
+    ap->pollinfo.Handles[0].Handle = (HANDLE)s;
+    ap->pollinfo.Handles[0].Status = 0;
+    ap->pollinfo.Handles[0].Events = events;
+
+    if (afdpoll((HANDLE)ap->peer_socket, &ap->pollinfo, sizeof(ap->pollinfo), &ap->ol) < 0) {
+        switch (errno) {
+        case ERROR_IO_PENDING:
+            break;
+        case ERROR_INVALID_HANDLE:
+            return EPOLL_POLL_GONE;
+        default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*queues the completion of a member poll that no ioctl will complete*/
+static void _afd_postmember(pafd_port aport, pafd_poll ap, uint32_t events) {
+    ap->pollinfo.NumberOfHandles = 1;
+    ap->pollinfo.Handles[0].Events = events;
+    PostQueuedCompletionStatus(aport->iocp, 0, 0, &ap->ol);
+}
+
+static void _afd_groupdel(pafd_group g, uint32_t n) {
+    g->members[n]->flags &= ~AFD_POLL_GROUPED;
+    g->members[n] = g->members[--g->nmembers];
+    g->dirty = 1;
+}
+
+static SOCKET _afd_membersocket(pafd_poll ap) {
+    /*the blob is the first member of epoll_poll*/
+    return (SOCKET)((pepoll_poll)ap)->socket;
+}
+
+/*index of the member polling s, nmembers if none*/
+static uint32_t _afd_groupfind(pafd_group g, HANDLE s) {
+    uint32_t n;
+    for (n = 0; n < g->nmembers; n++) {
+        if ((HANDLE)_afd_membersocket(g->members[n]) == s)
+            break;
+    }
+    return n;
+}
+
+/*index of member ap, nmembers if it is not one*/
+static uint32_t _afd_groupindex(pafd_group g, pafd_poll ap) {
+    uint32_t n;
+    for (n = 0; n < g->nmembers; n++) {
+        if (g->members[n] == ap)
+            break;
+    }
+    return n;
+}
+
+/*
+ * the group ioctl was refused, one of the sockets is likely gone: every
+ * member is polled on its own, the gone ones complete with a close.
+ */
+static void _afd_groupsplit(pafd_port aport, pafd_group g) {
+    pafd_poll ap;
+
+    while (g->nmembers > 0) {
+        ap = g->members[0];
+        _afd_groupdel(g, 0);
+        switch (_afd_pollone(ap, _afd_membersocket(ap), ap->pollinfo.Handles[0].Events, 0)) {
+        case 0:
+            break;
+        case EPOLL_POLL_GONE:
+            ap->flags |= AFD_POLL_GONE;
+            _afd_postmember(aport, ap, AFD_POLL_LOCAL_CLOSE);
+            break;
+        default:
+            _afd_postmember(aport, ap, 0);
+            break;
+        }
+    }
+    g->dirty = 0;
+}
+
+/*issues the group ioctl for the current members, aport->lock held*/
+static void _afd_groupsubmit(pafd_port aport, pafd_group g) {
+    uint32_t n;
+    DWORD size;
+
+    if (g->dead || !g->dirty)
+        return;
+    if (g->inflight) {
+        /*reissued with the new members when the cancel completes*/
+        if (!g->cancelling && afdcancelpoll((HANDLE)g->peer->s, &g->ol) == 0)
+            g->cancelling = 1;
+        return;
+    }
+    g->dirty = 0;
+    if (g->nmembers == 0)
+        return;
+
+    g->info.Timeout.QuadPart = INT64_MAX;
+    g->info.NumberOfHandles = g->nmembers;
+    g->info.Exclusive = FALSE;
+    for (n = 0; n < g->nmembers; n++) {
+        g->info.Handles[n].Handle = (HANDLE)_afd_membersocket(g->members[n]);
+        g->info.Handles[n].Events = g->members[n]->pollinfo.Handles[0].Events;
+        g->info.Handles[n].Status = 0;
+    }
+    size = (DWORD)(offsetof(afd_group, info.Handles) - offsetof(afd_group, info) +
+        g->nmembers * sizeof(AFD_POLL_HANDLE_INFO));
+    memset(&g->ol, 0, sizeof(g->ol));
+
+    if (afdpoll((HANDLE)g->peer->s, (AFD_POLL_INFO*)&g->info, size, &g->ol) == 0 ||
+        errno == ERROR_IO_PENDING) {
+        g->inflight = 1;
+        return;
+    }
+    _afd_groupsplit(aport, g);
+}
+
+/*
+ * a group ioctl completed: its reported members become completions in out
+ * (posted when out is full), the rest is polled again. Returns how many
+ * were written to out. aport->lock held.
+ */
+static int _afd_groupdone(pafd_port aport, pafd_group g, pepoll_completion out, int room) {
+    uint32_t n, m, count = 0;
+    pafd_poll ap;
+    int i = 0;
+
+    g->inflight = 0;
+    g->cancelling = 0;
+    if (g->dead) {
+        _afd_closepeer(aport, g->peer);
+        return 0;
+    }
+
+    if (g->ol.Internal == 0)
+        count = g->info.NumberOfHandles;
+
+    for (n = 0; n < count; n++) {
+        m = _afd_groupfind(g, g->info.Handles[n].Handle);
+        /*cancelled or deleted since the ioctl was issued*/
+        if (m == g->nmembers)
+            continue;
+        ap = g->members[m];
+        _afd_groupdel(g, m);
+        ap->pollinfo.NumberOfHandles = 1;
+        ap->pollinfo.Handles[0].Events = g->info.Handles[n].Events;
+        if (i < room) {
+            out[i].poll = (pepoll_poll)ap;
+            out[i].key = 0;
+            out[i].value = 0;
+            out[i++].events = g->info.Handles[n].Events;
+        }
+        else {
+            PostQueuedCompletionStatus(aport->iocp, 0, 0, &ap->ol);
+        }
+    }
+
+    g->dirty = 1;
+    _afd_groupsubmit(aport, g);
+    return i;
+}
+
+static pafd_group _afd_group(pafd_port aport, pafd_peer peer) {
+    if (peer->group != NULL)
+        return peer->group;
+    pafd_group g = (pafd_group)calloc(1, sizeof(afd_group));
+    if (g == NULL)
+        return NULL;
+    g->kind = AFD_KIND_GROUP;
+    g->peer = peer;
+    aport->groups.push_back(g);
+    peer->group = g;
+    return g;
+}
+
+static int _afd_groupsbusy(pafd_port aport) {
+    size_t n;
+    for (n = 0; n < aport->groups.size(); n++) {
+        if (aport->groups[n]->inflight)
+            return 1;
+    }
+    return 0;
+}
+
+static int _afd_create(pepoll_port port) {
+    pafd_port aport = new (std::nothrow) afd_port();
+    if (aport == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    aport->iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (aport->iocp == NULL) {
+        delete aport;
+        errno = ENOMEM;
+        return -1;
+    }
+    aport->grouped = (port->flags & EPOLL_PORT_GROUPED) != 0;
+    port->handle = aport;
+    return 0;
+}
+
+static void _afd_destroy(pepoll_port port) {
+    pafd_port aport = (pafd_port)port->handle;
+    OVERLAPPED_ENTRY entry;
+    ULONG count;
+    pafd_group g;
+    pafd_peer peer;
+    size_t n;
+    int i;
+
+    /*group ioctls the engine doesn't know about have to finish first*/
+    for (n = 0; n < aport->groups.size(); n++) {
+        g = aport->groups[n];
+        g->dead = 1;
+        if (g->inflight)
+            afdcancelpoll((HANDLE)g->peer->s, &g->ol);
+    }
+    while (_afd_groupsbusy(aport)) {
+        if (!GetQueuedCompletionStatusEx(aport->iocp, &entry, 1, &count, 1000, FALSE))
+            break;
+        g = (pafd_group)entry.lpOverlapped;
+        if (g != NULL && g->kind == AFD_KIND_GROUP)
+            g->inflight = 0;
+    }
+    for (n = 0; n < aport->groups.size(); n++) {
+        g = aport->groups[n];
+        /*still owned by the kernel if the wait above gave up*/
+        if (!g->inflight)
+            g->peer->group = NULL;
+        if (g->peer->refs == 0 && !g->inflight) {
+            closesocket(g->peer->s);
+            free(g->peer);
+        }
+        if (!g->inflight)
+            free(g);
+    }
+
+    /*every registration was detached, only a leak would leave peers here*/
+    for (i = 0; i < AFD_PROVIDERS; i++) {
+        while ((peer = aport->avail[i]) != NULL) {
+            _afd_unavail(aport, peer);
+            if (peer->group != NULL)
+                continue;
+            closesocket(peer->s);
+            free(peer);
+        }
+    }
+    CloseHandle(aport->iocp);
+    delete aport;
+    port->handle = NULL;
+}
+
+/*
+ * pipes: a zero byte overlapped ReadFile completes once there is data (a
+ * ConnectNamedPipe once a server end that is still listening has a
+ * client). Its OVERLAPPED event has the low bit set, so the handle is never
+ * bound to a completion port and can be registered with any number of
+ * instances; a thread pool wait posts the completion when it is signalled.
+ * Nothing tells when a pipe write would block, pipes are always writable.
+ */
+static int _afd_attachpipe(pafd_port aport, pafd_poll ap, pepoll_poll p, uint64_t handle) {
+    DWORD type = GetFileType((HANDLE)handle);
+
+    if (type != FILE_TYPE_PIPE) {
+        errno = type == FILE_TYPE_UNKNOWN && GetLastError() != NO_ERROR ? EBADF : EINVAL;
+        return -1;
+    }
+    ap->kind = AFD_KIND_PIPE;
+    ap->pipe.event = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (ap->pipe.event == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    ap->pipe.iocp = aport->iocp;
+    {
+        std::lock_guard<std::mutex> lock1(aport->lock);
+        aport->sockets++;
+    }
+    p->socket = handle;
+    return 0;
+}
+
+/*what can be told without waiting: data to read, or the other end gone*/
+static uint32_t _afd_pipeready(HANDLE h) {
+    DWORD avail = 0;
+
+    if (PeekNamedPipe(h, NULL, 0, NULL, &avail, NULL))
+        return avail > 0 ? AFD_POLL_RECEIVE : 0;
+    switch (GetLastError()) {
+    case ERROR_BROKEN_PIPE:
+    case ERROR_NO_DATA:
+        return AFD_POLL_DISCONNECT;
+    default:
+        return 0;
+    }
+}
+
+static int _afd_pipepost(pafd_poll ap, uint32_t events) {
+    ap->flags |= AFD_PIPE_POSTED;
+    ap->pollinfo.NumberOfHandles = 1;
+    ap->pollinfo.Handles[0].Events = events;
+    if (!PostQueuedCompletionStatus(ap->pipe.iocp, 0, 0, &ap->ol)) {
+        ap->flags &= ~AFD_PIPE_POSTED;
+        errno = GetLastError();
+        return -1;
+    }
+    return 0;
+}
+
+static VOID CALLBACK _afd_pipesignalled(PVOID arg, BOOLEAN timedout) {
+    pafd_poll ap = (pafd_poll)arg;
+    (void)timedout;
+    /*the record may be gone once it is queued, nothing touches it after*/
+    PostQueuedCompletionStatus(ap->pipe.iocp, 0, 0, &ap->ol);
+}
+
+static int _afd_pollpipe(pafd_poll ap, HANDLE h, uint32_t events) {
+    static char zero;
+    uint32_t ready = 0;
+    DWORD bytes;
+
+    if (events & AFD_POLL_SEND) {
+        ready = _afd_pipeready(h) | AFD_POLL_SEND;
+        return _afd_pipepost(ap, ready & events);
+    }
+
+    memset(&ap->ol, 0, sizeof(ap->ol));
+    ResetEvent(ap->pipe.event);
+    ap->ol.hEvent = (HANDLE)((uintptr_t)ap->pipe.event | 1);
+
+    if (!ReadFile(h, &zero, 0, NULL, &ap->ol)) {
+        switch (GetLastError()) {
+        case ERROR_IO_PENDING:
+        case ERROR_MORE_DATA:
+            break;
+        case ERROR_PIPE_LISTENING:
+            /*a server end without a client, connecting is its readiness*/
+            if (ConnectNamedPipe(h, &ap->ol) || GetLastError() == ERROR_IO_PENDING)
+                break;
+            if (GetLastError() == ERROR_PIPE_CONNECTED)
+                return _afd_pipepost(ap, AFD_POLL_RECEIVE & events);
+            if (GetLastError() == ERROR_NO_DATA)
+                return _afd_pipepost(ap, AFD_POLL_DISCONNECT & events);
+            errno = GetLastError();
+            return -1;
+        case ERROR_BROKEN_PIPE:
+        case ERROR_NO_DATA:
+            return _afd_pipepost(ap, AFD_POLL_DISCONNECT & events);
+        case ERROR_INVALID_HANDLE:
+            ap->flags |= AFD_POLL_GONE;
+            return EPOLL_POLL_GONE;
+        default:
+            errno = GetLastError();
+            return -1;
+        }
+    }
+
+    if (!RegisterWaitForSingleObject(&ap->pipe.wait, ap->pipe.event, _afd_pipesignalled, ap,
+        INFINITE, WT_EXECUTEONLYONCE)) {
+        errno = GetLastError();
+        CancelIoEx(h, &ap->ol);
+        GetOverlappedResult(h, &ap->ol, &bytes, TRUE);
+        return -1;
+    }
+    return 0;
+}
+
+/*events of a dequeued pipe completion*/
+static uint32_t _afd_pipedone(pafd_poll ap, HANDLE h) {
+    DWORD bytes;
+
+    if (ap->flags & AFD_PIPE_POSTED) {
+        ap->flags &= ~AFD_PIPE_POSTED;
+        return ap->pollinfo.Handles[0].Events;
+    }
+    UnregisterWait(ap->pipe.wait);
+    ap->pipe.wait = NULL;
+    if (GetOverlappedResult(h, &ap->ol, &bytes, FALSE))
+        return AFD_POLL_RECEIVE;
+    switch (GetLastError()) {
+    case ERROR_MORE_DATA:
+    case ERROR_PIPE_CONNECTED:
+        return AFD_POLL_RECEIVE;
+    case ERROR_OPERATION_ABORTED:
+        return 0;
+    default:
+        return AFD_POLL_DISCONNECT;
+    }
+}
+
+static int _afd_attach(pepoll_port port, pepoll_poll p, uint64_t socket) {
+    pafd_port aport = (pafd_port)port->handle;
+    pafd_poll ap = new (p->blob) afd_poll();
+    SOCKET s = (SOCKET)socket;
+    SOCKET basesocket = INVALID_SOCKET;
+    WSAPROTOCOL_INFOW protocol_info;
+    DWORD returnbytes;
+    int len;
+
+    if (p->type == EPOLL_HANDLE_PIPE)
+        return _afd_attachpipe(aport, ap, p, socket);
+
+    if (WSAIoctl(s, SIO_BASE_HANDLE, NULL, 0, &basesocket, sizeof(basesocket), &returnbytes, NULL, NULL) == SOCKET_ERROR) {
+        errno = WSAGetLastError();
+        return -1;
+    }
+
+    s = basesocket;
+
+    len = sizeof protocol_info;
+    if (getsockopt(s,
+        SOL_SOCKET,
+        SO_PROTOCOL_INFOW,
+        (char*)&protocol_info,
+        &len) != 0) {
+        errno = WSAGetLastError();
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock1(aport->lock);
+        ap->peer = _afd_getpeer(aport, &protocol_info);
+        aport->sockets++;
+    }
+    ap->peer_socket = ap->peer != NULL ? ap->peer->s : INVALID_SOCKET;
+
+    if (ap->peer == NULL) {
+        if (!SetHandleInformation((HANDLE)s, HANDLE_FLAG_INHERIT, 0) ||
+            CreateIoCompletionPort((HANDLE)s,
+            aport->iocp,
+            (ULONG_PTR)s,
+            0) == NULL) {
+            errno = GetLastError();
+            std::lock_guard<std::mutex> lock1(aport->lock);
+            aport->sockets--;
+            return -1;
+        }
+        ap->peer_socket = s;
+    }
+
+    p->socket = (uint64_t)s;
+    return 0;
+}
+
+static void _afd_detach(pepoll_port port, pepoll_poll p) {
+    pafd_port aport = (pafd_port)port->handle;
+    pafd_poll ap = (pafd_poll)p->blob;
+    std::lock_guard<std::mutex> lock1(aport->lock);
+    if (ap->kind == AFD_KIND_PIPE) {
+        CloseHandle(ap->pipe.event);
+        aport->sockets--;
+        return;
+    }
+    if (ap->peer != NULL)
+        _afd_putpeer(aport, ap->peer);
+    ap->peer = NULL;
+    aport->sockets--;
+}
+
+static void _afd_handles(pepoll_port port, uint32_t* handles, uint32_t* sockets) {
+    pafd_port aport = (pafd_port)port->handle;
+    std::lock_guard<std::mutex> lock1(aport->lock);
+    *handles = aport->peers;
+    *sockets = aport->sockets;
+}
+
+static int _afd_poll(pepoll_port port, pepoll_poll p, uint32_t events) {
+    pafd_port aport = (pafd_port)port->handle;
+    pafd_poll ap = (pafd_poll)p->blob;
+    pafd_group g;
+
+    if (ap->flags & AFD_POLL_GONE)
+        return EPOLL_POLL_GONE;
+    if (ap->kind == AFD_KIND_PIPE)
+        return _afd_pollpipe(ap, (HANDLE)p->socket, events);
+
+    if (aport->grouped && ap->peer != NULL && !p->exclusive) {
+        std::lock_guard<std::mutex> lock1(aport->lock);
+        if ((g = _afd_group(aport, ap->peer)) != NULL) {
+            ap->flags |= AFD_POLL_GROUPED;
+            ap->pollinfo.NumberOfHandles = 1;
+            ap->pollinfo.Handles[0].Events = events;
+            g->members[g->nmembers++] = ap;
+            g->dirty = 1;
+            return 0;
+        }
+    }
+
+    return _afd_pollone(ap, (SOCKET)p->socket, events, p->exclusive);
+}
+
+/*
+ * FIONREAD on the socket answers for data to read without an AFD poll,
+ * anything else is left to the poll
+ */
+static uint32_t _afd_probe(pepoll_port port, pepoll_poll p, uint32_t events) {
+    pafd_poll ap = (pafd_poll)p->blob;
+    u_long avail = 0;
+
+    (void)port;
+    if (!(events & AFD_POLL_RECEIVE) || (ap->flags & AFD_POLL_GONE))
+        return 0;
+    if (ap->kind == AFD_KIND_PIPE)
+        return _afd_pipeready((HANDLE)p->socket) & AFD_POLL_RECEIVE;
+    if (ioctlsocket((SOCKET)p->socket, FIONREAD, &avail) != 0 || avail == 0)
+        return 0;
+    return AFD_POLL_RECEIVE;
+}
+
+static int _afd_cancel(pepoll_port port, pepoll_poll p) {
+    pafd_port aport = (pafd_port)port->handle;
+    pafd_poll ap = (pafd_poll)p->blob;
+    pafd_group g;
+
+    if (ap->kind == AFD_KIND_PIPE) {
+        if (ap->flags & AFD_PIPE_POSTED)
+            return -1;
+        return afdcancelpoll((HANDLE)p->socket, &ap->ol);
+    }
+    if (aport->grouped) {
+        std::lock_guard<std::mutex> lock1(aport->lock);
+        if (ap->flags & AFD_POLL_GROUPED) {
+            /*by record, the handle may be closed and reused by another member*/
+            g = ap->peer->group;
+            _afd_groupdel(g, _afd_groupindex(g, ap));
+            _afd_postmember(aport, ap, 0);
+            return 0;
+        }
+    }
+    return afdcancelpoll((HANDLE)ap->peer_socket, &ap->ol);
+}
+
+/*issues the group polls changed since the last flush*/
+static void _afd_flush(pepoll_port port) {
+    pafd_port aport = (pafd_port)port->handle;
+    size_t n;
+
+    if (!aport->grouped)
+        return;
+    std::lock_guard<std::mutex> lock1(aport->lock);
+    for (n = 0; n < aport->groups.size(); n++)
+        _afd_groupsubmit(aport, aport->groups[n]);
+}
+
+static int _afd_dequeue(pepoll_port port, pepoll_completion out, uint32_t max, int timeout) {
+    /*dequeue buffer reused by every wait issued from this thread*/
+    static thread_local std::vector<OVERLAPPED_ENTRY> entries;
+    pafd_port aport = (pafd_port)port->handle;
+    ULONGLONG deadline = timeout < 0 ? 0 : GetTickCount64() + timeout;
+    DWORD wait = timeout < 0 ? INFINITE : (DWORD)timeout;
+    ULONG count, n;
+    pafd_poll ap;
+    int i;
+
+    if (entries.size() < max)
+        entries.resize(max);
+
+    for (;;) {
+        if (!GetQueuedCompletionStatusEx(aport->iocp, entries.data(), max, &count, wait, FALSE)) {
+            if (GetLastError() == WAIT_TIMEOUT)
+                return 0;
+            errno = EINVAL;
+            return -1;
+        }
+
+        for (n = 0, i = 0; n < count; n++) {
+            ap = (pafd_poll)entries[n].lpOverlapped;
+            if (ap != NULL && ap->kind == AFD_KIND_GROUP) {
+                std::lock_guard<std::mutex> lock1(aport->lock);
+                i += _afd_groupdone(aport, (pafd_group)ap, out + i, (int)(max - (count - n - 1)) - i);
+                continue;
+            }
+            if (ap != NULL && ap->kind == AFD_KIND_PIPE) {
+                out[i].poll = (pepoll_poll)ap;
+                out[i].key = entries[n].lpCompletionKey;
+                out[i].value = 0;
+                out[i].events = _afd_pipedone(ap, (HANDLE)((pepoll_poll)ap)->socket);
+                i++;
+                continue;
+            }
+            if (ap != NULL && ap->kind == AFD_KIND_IO) {
+                DWORD bytes, flags;
+                out[i].poll = (pepoll_poll)ap;
+                out[i].key = EPOLL_IO_KEY;
+                out[i].value = entries[n].dwNumberOfBytesTransferred;
+                out[i].events = 0;
+                if (!WSAGetOverlappedResult(ap->peer_socket, &ap->ol, &bytes, FALSE, &flags))
+                    out[i].events = WSAGetLastError() == WSA_OPERATION_ABORTED ? ECANCELED : WSAGetLastError();
+                i++;
+                continue;
+            }
+            out[i].poll = (pepoll_poll)entries[n].lpOverlapped;
+            out[i].key = entries[n].lpCompletionKey;
+            out[i].value = entries[n].dwNumberOfBytesTransferred;
+            out[i].events = 0;
+            if (ap != NULL && ap->pollinfo.NumberOfHandles >= 1)
+                out[i].events = ap->pollinfo.Handles[0].Events;
+            i++;
+        }
+
+        /*only group polls that were reissued, wait for the rest of the timeout*/
+        if (i > 0 || count == 0)
+            return i;
+        if (timeout >= 0) {
+            ULONGLONG now = GetTickCount64();
+            if (now >= deadline)
+                return 0;
+            wait = (DWORD)(deadline - now);
+        }
+    }
+}
+
+static int _afd_post(pepoll_port port, pepoll_poll p, uintptr_t key, uint32_t value) {
+    LPOVERLAPPED ol = p != NULL ? &((pafd_poll)p->blob)->ol : NULL;
+    if (!PostQueuedCompletionStatus(((pafd_port)port->handle)->iocp, value, key, ol)) {
+        errno = GetLastError();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * overlapped WSARecv/WSASend on the socket itself, so it is associated
+ * with the port here. A socket belongs to one port, submit to a single
+ * instance per socket.
+ */
+static int _afd_submit(pepoll_port port, pepoll_poll p, uint64_t socket, int send, void* buf, uint32_t len) {
+    pafd_port aport = (pafd_port)port->handle;
+    pafd_poll ap = new (p->blob) afd_poll();
+    SOCKET s = (SOCKET)socket;
+    WSABUF wsabuf;
+    DWORD flags = 0;
+    int ret;
+
+    ap->kind = AFD_KIND_IO;
+    ap->peer_socket = s;
+    /*fails harmlessly when an earlier submit associated it already*/
+    CreateIoCompletionPort((HANDLE)s, aport->iocp, 0, 0);
+
+    wsabuf.buf = (char*)buf;
+    wsabuf.len = len;
+    if (send)
+        ret = WSASend(s, &wsabuf, 1, NULL, 0, &ap->ol, NULL);
+    else
+        ret = WSARecv(s, &wsabuf, 1, NULL, &flags, &ap->ol, NULL);
+    /*a synchronous success still queues its completion*/
+    if (ret == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
+        errno = WSAGetLastError();
+        return -1;
+    }
+    return 0;
+}
+
+const epoll_backend epoll_backend_afd = {
+    "afd",
+    _afd_create,
+    _afd_destroy,
+    _afd_attach,
+    _afd_detach,
+    _afd_poll,
+    _afd_cancel,
+    _afd_dequeue,
+    _afd_post,
+    _afd_handles,
+    _afd_flush,
+    _afd_submit,
+    _afd_probe,
+    1
+};
+#endif
@@ -0,0 +1,145 @@
+/*@file epoll_backend.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "epoll_events.h"
+
+/*
+ * What the engine in epoll.cpp needs from the OS: a completion port and
+ * one-shot polls whose completions are queued on it.
+ *
+ * A poll is issued for a set of AFD_POLL_* bits and completes once, either
+ * when one of them is ready (at once if it already is) or as cancelled.
+ * Exactly one completion is queued per poll that was issued, the engine
+ * counts on it to know when the kernel is done with a record. Posted
+ * entries wake a waiter and carry a key and a value.
+ *
+ * Backends: AFD on Windows, native epoll on Linux, and an in-memory one
+ * driven by tests (epoll_sim.h).
+ */
+
+#define EPOLL_POLL_BLOB 96
+
+/*poll returns this when the socket is gone, no poll was queued*/
+#define EPOLL_POLL_GONE 1
+
+/*completion key of a submitted recv or send*/
+#define EPOLL_IO_KEY (~(uintptr_t)0)
+
+struct _epoll_backend;
+
+/*epoll_port flags, from epoll_create1*/
+#define EPOLL_PORT_GROUPED 1    /* pack the polls of many sockets per request */
+
+typedef struct _epoll_port {
+    const struct _epoll_backend* backend;
+    void* handle;
+    uint32_t flags;
+} epoll_port, *pepoll_port;
+
+/*
+ * per registration poll state, the first member of the engine's record so
+ * a completion leads straight back to it
+ */
+typedef struct _epoll_poll {
+    /*backend private, first so AFD's OVERLAPPED sits at the record address*/
+    union {
+        unsigned char blob[EPOLL_POLL_BLOB];
+        uint64_t align;
+    };
+    uint64_t socket;        /* handle the polls are issued on, set by attach */
+    int exclusive;
+    uint32_t type;          /* EPOLL_HANDLE_SOCKET or _PIPE, set before attach */
+} epoll_poll, *pepoll_poll;
+
+typedef struct _epoll_completion {
+    pepoll_poll poll;       /* NULL for entries posted without one */
+    uintptr_t key;
+    uint32_t value;
+    uint32_t events;        /* AFD_POLL_* bits the poll reported */
+} epoll_completion, *pepoll_completion;
+
+typedef struct _epoll_backend {
+    const char* name;
+    int (*create)(pepoll_port port);
+    void (*destroy)(pepoll_port port);
+    /*
+     * socket is the one given to epoll_ctl, p->socket gets the one polled.
+     * attach and detach of one port are serialized by the engine. Backends
+     * whose native poll takes pipes can ignore p->type.
+     */
+    int (*attach)(pepoll_port port, pepoll_poll p, uint64_t socket);
+    void (*detach)(pepoll_port port, pepoll_poll p);
+    /*0 when queued, EPOLL_POLL_GONE or -1 with errno set*/
+    int (*poll)(pepoll_port port, pepoll_poll p, uint32_t events);
+    /*0 if the poll will complete as cancelled, -1 if it completed already*/
+    int (*cancel)(pepoll_port port, pepoll_poll p);
+    /*
+     * waits up to timeout ms (-1 forever) for the first completion, then
+     * takes what is queued up to max. Returns the count, 0 on timeout.
+     */
+    int (*dequeue)(pepoll_port port, pepoll_completion out, uint32_t max, int timeout);
+    int (*post)(pepoll_port port, pepoll_poll p, uintptr_t key, uint32_t value);
+    /*helper handles the port opened for its polls and the sockets attached*/
+    void (*handles)(pepoll_port port, uint32_t* handles, uint32_t* sockets);
+    /*
+     * optional, issues polls the backend held back to send together. Called
+     * after each pass over the rearm list, a held back poll still counts as
+     * issued and completes once like any other.
+     */
+    void (*flush)(pepoll_port port);
+    /*
+     * optional, starts a recv (send 0) or send of up to len bytes at buf on
+     * socket, p is not attached. It completes once like a poll, with key
+     * EPOLL_IO_KEY, the bytes transferred in value and 0 or the errno in
+     * events, and can be cancelled like a poll (events ECANCELED). Returns
+     * -1 with errno set when nothing was started.
+     */
+    int (*submit)(pepoll_port port, pepoll_poll p, uint64_t socket, int send, void* buf, uint32_t len);
+    /*
+     * optional, which of events p's socket has right now without queueing
+     * anything, 0 when none or when that is not cheap to tell. p is
+     * attached and has no poll outstanding.
+     */
+    uint32_t (*probe)(pepoll_port port, pepoll_poll p, uint32_t events);
+    /*
+     * non-zero when cancel only touches the poll, never its socket, so it
+     * can be issued after the socket was closed and its handle reused.
+     * The engine then batches the cancels of deleted registrations.
+     */
+    int latecancel;
+} epoll_backend, *pepoll_backend;
+
+#ifdef _WIN32
+extern const epoll_backend epoll_backend_afd;
+#endif
+#ifdef __linux__
+extern const epoll_backend epoll_backend_linux;
+#endif
+extern const epoll_backend epoll_backend_sim;
+
+/*backend of the instances created from now on, NULL restores the default*/
+void epoll_setbackend(const epoll_backend* backend);
@@ -0,0 +1,69 @@
+/*@file epoll_et.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Edge triggered bookkeeping for one registration.
+ *
+ * AFD polls are one-shot and level based: a poll issued while the socket
+ * is readable completes at once. Level triggered records are therefore
+ * re-armed by whichever thread calls epoll_wait next, which hands the same
+ * readiness to a second waiter while the first one is still reading.
+ *
+ * An EPOLLET record instead latches the events it reported together with
+ * the waiter that received them and stays disarmed until that waiter calls
+ * epoll_wait again. By the ET contract the reader has drained the socket
+ * by then, so anything the re-armed poll reports is new data or a new
+ * state. Should the reader never come back (thread gone, loop stopped)
+ * the record is released after EPOLL_ET_DEFER_WAITS waits by other
+ * threads so it cannot starve.
+ */
+
+#define EPOLL_ET_DEFER_WAITS 64
+
+typedef struct _epoll_et_state {
+    uint32_t latched;       /* events reported and not re-armed yet */
+    uint32_t stamp;         /* instance wait sequence at report time */
+    const void* owner;      /* waiter the events were reported to */
+} epoll_et_state, *pepoll_et_state;
+
+static inline void epoll_et_latch(pepoll_et_state st, uint32_t events,
+    const void* waiter, uint32_t waitseq) {
+    st->latched |= events;
+    st->owner = waiter;
+    st->stamp = waitseq;
+}
+
+static inline int epoll_et_releasable(const epoll_et_state* st,
+    const void* waiter, uint32_t waitseq) {
+    return st->owner == waiter || waitseq - st->stamp > EPOLL_ET_DEFER_WAITS;
+}
+
+static inline void epoll_et_release(pepoll_et_state st) {
+    st->latched = 0;
+    st->owner = NULL;
+}
@@ -0,0 +1,46 @@
+/*@file epoll_events.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+/*
+ * event bits of the emulation, these are the AFD poll bits on every
+ * platform so backends other than AFD translate to and from them.
+ */
+#define AFD_POLL_RECEIVE           1
+#define AFD_POLL_RECEIVE_EXPEDITED 2
+#define AFD_POLL_SEND              4
+#define AFD_POLL_DISCONNECT        8
+#define AFD_POLL_ABORT             16
+#define AFD_POLL_LOCAL_CLOSE       32
+#define AFD_POLL_ACCEPT            128
+#define AFD_POLL_CONNECT_FAIL      256
+
+/*
+ * what an fd stands for (epoll_handle2fd). Pipes are polled with zero byte
+ * reads, regular files are always ready as poll(2) reports them on Linux.
+ */
+#define EPOLL_HANDLE_SOCKET 0
+#define EPOLL_HANDLE_PIPE   1
+#define EPOLL_HANDLE_FILE   2
@@ -0,0 +1,415 @@
+/*@file epoll_linux.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifdef __linux__
+#include "epoll_backend.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/*
+ * native epoll underneath the emulation, so the engine can be tested and
+ * profiled on Linux. A poll is a EPOLLONESHOT registration whose event is
+ * the completion. Cancellations and posted entries go through a user
+ * space queue, an eventfd in semaphore mode counts them so each one wakes
+ * a waiter.
+ *
+ * A submitted recv or send is tried at once and otherwise waits for
+ * readiness on a dup of the socket, native epoll allows one registration
+ * per file, which the socket's poll may be holding.
+ */
+
+typedef struct _linux_port {
+    int epfd;
+    int wakefd;
+    std::mutex lock;
+    std::deque<epoll_completion> posted;
+    uint32_t sockets;
+} linux_port, *plinux_port;
+
+/*armed is claimed by whoever completes the poll, the event or a cancel*/
+typedef struct _linux_poll {
+    std::atomic<int> armed;
+    int registered;
+    /*submitted operations only, iofd is the dup while one waits*/
+    int io;
+    int iofd;
+    int send;
+    void* buf;
+    uint32_t len;
+} linux_poll, *plinux_poll;
+
+static_assert(sizeof(linux_poll) <= EPOLL_POLL_BLOB, "linux_poll does not fit EPOLL_POLL_BLOB");
+
+static uint32_t _tonative(uint32_t events) {
+    uint32_t native = 0;
+    if (events & (AFD_POLL_RECEIVE | AFD_POLL_ACCEPT))
+        native |= EPOLLIN;
+    if (events & AFD_POLL_RECEIVE_EXPEDITED)
+        native |= EPOLLPRI;
+    if (events & AFD_POLL_SEND)
+        native |= EPOLLOUT;
+    if (events & AFD_POLL_DISCONNECT)
+        native |= EPOLLRDHUP;
+    return native;
+}
+
+static uint32_t _fromnative(uint32_t native) {
+    uint32_t events = 0;
+    if (native & EPOLLIN)
+        events |= AFD_POLL_RECEIVE | AFD_POLL_ACCEPT;
+    if (native & EPOLLPRI)
+        events |= AFD_POLL_RECEIVE_EXPEDITED;
+    if (native & EPOLLOUT)
+        events |= AFD_POLL_SEND;
+    if (native & (EPOLLRDHUP | EPOLLHUP))
+        events |= AFD_POLL_DISCONNECT;
+    if (native & EPOLLERR)
+        events |= AFD_POLL_ABORT | AFD_POLL_CONNECT_FAIL;
+    return events;
+}
+
+static int _linux_create(pepoll_port port) {
+    struct epoll_event ev = {};
+    plinux_port lp = new (std::nothrow) linux_port();
+
+    if (lp == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    lp->epfd = epoll_create1(EPOLL_CLOEXEC);
+    lp->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (lp->epfd < 0 || lp->wakefd < 0 ||
+        epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->wakefd, &ev) < 0) {
+        if (lp->epfd >= 0)
+            ::close(lp->epfd);
+        if (lp->wakefd >= 0)
+            ::close(lp->wakefd);
+        delete lp;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    port->handle = lp;
+    return 0;
+}
+
+static void _linux_destroy(pepoll_port port) {
+    plinux_port lp = (plinux_port)port->handle;
+    ::close(lp->epfd);
+    ::close(lp->wakefd);
+    delete lp;
+    port->handle = NULL;
+}
+
+static int _linux_attach(pepoll_port port, pepoll_poll p, uint64_t socket) {
+    if (fcntl((int)socket, F_GETFD) < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    new (p->blob) linux_poll();
+    p->socket = socket;
+    ((plinux_port)port->handle)->sockets++;
+    return 0;
+}
+
+static void _linux_detach(pepoll_port port, pepoll_poll p) {
+    plinux_poll np = (plinux_poll)p->blob;
+    plinux_port lp = (plinux_port)port->handle;
+
+    if (np->registered)
+        epoll_ctl(lp->epfd, EPOLL_CTL_DEL, (int)p->socket, NULL);
+    np->registered = 0;
+    np->~linux_poll();
+    lp->sockets--;
+}
+
+/*sockets are registered on the port's own epoll fd, no helper handles*/
+static void _linux_handles(pepoll_port port, uint32_t* handles, uint32_t* sockets) {
+    *handles = 0;
+    *sockets = ((plinux_port)port->handle)->sockets;
+}
+
+static int _linux_push(pepoll_port port, pepoll_poll p, uintptr_t key, uint32_t value, uint32_t events) {
+    plinux_port lp = (plinux_port)port->handle;
+    epoll_completion c;
+    uint64_t one = 1;
+
+    c.poll = p;
+    c.key = key;
+    c.value = value;
+    c.events = events;
+    {
+        std::lock_guard<std::mutex> lock1(lp->lock);
+        lp->posted.push_back(c);
+    }
+    if (write(lp->wakefd, &one, sizeof one) != sizeof one)
+        return -1;
+    return 0;
+}
+
+static int _linux_post(pepoll_port port, pepoll_poll p, uintptr_t key, uint32_t value) {
+    return _linux_push(port, p, key, value, 0);
+}
+
+/*one non-blocking attempt at a submitted operation, -1 with errno when it failed*/
+static ssize_t _linux_io(plinux_poll np, int fd) {
+    if (np->send)
+        return ::send(fd, np->buf, np->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return ::recv(fd, np->buf, np->len, MSG_DONTWAIT);
+}
+
+static int _linux_submit(pepoll_port port, pepoll_poll p, uint64_t socket, int send, void* buf, uint32_t len) {
+    plinux_poll np = new (p->blob) linux_poll();
+    plinux_port lp = (plinux_port)port->handle;
+    struct epoll_event ev = {};
+    ssize_t ret;
+
+    np->io = 1;
+    np->iofd = -1;
+    np->send = send;
+    np->buf = buf;
+    np->len = len;
+    p->socket = socket;
+
+    ret = _linux_io(np, (int)socket);
+    if (ret >= 0)
+        return _linux_push(port, p, EPOLL_IO_KEY, (uint32_t)ret, 0);
+    /*pipes and files take no submits, nothing was started*/
+    if (errno == ENOTSOCK) {
+        errno = EBADF;
+        return -1;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return _linux_push(port, p, EPOLL_IO_KEY, 0, (uint32_t)errno);
+
+    np->iofd = fcntl((int)socket, F_DUPFD_CLOEXEC, 0);
+    if (np->iofd < 0)
+        return -1;
+    ev.events = (send ? EPOLLOUT : EPOLLIN | EPOLLRDHUP) | EPOLLONESHOT;
+    ev.data.ptr = p;
+    np->armed = 1;
+    std::lock_guard<std::mutex> lock1(lp->lock);
+    if (epoll_ctl(lp->epfd, EPOLL_CTL_ADD, np->iofd, &ev) < 0) {
+        ::close(np->iofd);
+        np->iofd = -1;
+        np->armed = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * the dup became ready, finish the operation or wait again. Returns 1 if
+ * out was filled. Under lp->lock so a cancel can't close the dup meanwhile.
+ */
+static int _linux_iodone(plinux_port lp, pepoll_poll p, pepoll_completion out) {
+    plinux_poll np = (plinux_poll)p->blob;
+    struct epoll_event ev = {};
+    std::lock_guard<std::mutex> lock1(lp->lock);
+    int armed = 1;
+    ssize_t ret;
+
+    if (!np->armed.compare_exchange_strong(armed, 0))
+        return 0;
+
+    ret = _linux_io(np, np->iofd);
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        ev.events = (np->send ? EPOLLOUT : EPOLLIN | EPOLLRDHUP) | EPOLLONESHOT;
+        ev.data.ptr = p;
+        np->armed = 1;
+        epoll_ctl(lp->epfd, EPOLL_CTL_MOD, np->iofd, &ev);
+        return 0;
+    }
+
+    epoll_ctl(lp->epfd, EPOLL_CTL_DEL, np->iofd, NULL);
+    ::close(np->iofd);
+    np->iofd = -1;
+    out->poll = p;
+    out->key = EPOLL_IO_KEY;
+    out->value = ret < 0 ? 0 : (uint32_t)ret;
+    out->events = ret < 0 ? (uint32_t)errno : 0;
+    return 1;
+}
+
+static int _linux_poll(pepoll_port port, pepoll_poll p, uint32_t events) {
+    plinux_poll np = (plinux_poll)p->blob;
+    plinux_port lp = (plinux_port)port->handle;
+    struct epoll_event ev = {};
+    int ret;
+
+    ev.events = _tonative(events) | EPOLLONESHOT;
+    ev.data.ptr = p;
+    np->armed = 1;
+
+    ret = epoll_ctl(lp->epfd, np->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, (int)p->socket, &ev);
+    /*closed and reopened under the same number since the last poll*/
+    if (ret < 0 && errno == ENOENT)
+        ret = epoll_ctl(lp->epfd, EPOLL_CTL_ADD, (int)p->socket, &ev);
+
+    if (ret < 0) {
+        np->armed = 0;
+        np->registered = 0;
+        return errno == EBADF ? EPOLL_POLL_GONE : -1;
+    }
+    np->registered = 1;
+    return 0;
+}
+
+/*poll(2) with no timeout, the epoll set is not touched*/
+static uint32_t _linux_probe(pepoll_port port, pepoll_poll p, uint32_t events) {
+    struct pollfd pfd;
+
+    (void)port;
+
+    pfd.fd = (int)p->socket;
+    pfd.events = (short)_tonative(events);
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, 0) <= 0 || (pfd.revents & POLLNVAL))
+        return 0;
+    return _fromnative((uint32_t)pfd.revents) & events;
+}
+
+static int _linux_cancel(pepoll_port port, pepoll_poll p) {
+    plinux_poll np = (plinux_poll)p->blob;
+    plinux_port lp = (plinux_port)port->handle;
+    int armed = 1;
+
+    if (np->io) {
+        {
+            std::lock_guard<std::mutex> lock1(lp->lock);
+            if (!np->armed.compare_exchange_strong(armed, 0)) {
+                errno = ENOENT;
+                return -1;
+            }
+            epoll_ctl(lp->epfd, EPOLL_CTL_DEL, np->iofd, NULL);
+            ::close(np->iofd);
+            np->iofd = -1;
+        }
+        return _linux_push(port, p, EPOLL_IO_KEY, 0, ECANCELED);
+    }
+
+    if (!np->armed.compare_exchange_strong(armed, 0)) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    epoll_ctl(lp->epfd, EPOLL_CTL_DEL, (int)p->socket, NULL);
+    np->registered = 0;
+    return _linux_post(port, p, 0, 0);
+}
+
+static int _linux_dequeue(pepoll_port port, pepoll_completion out, uint32_t max, int timeout) {
+    static thread_local std::vector<struct epoll_event> events;
+    plinux_port lp = (plinux_port)port->handle;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    uint64_t value;
+    plinux_poll np;
+    int armed;
+    int count, i, wake;
+    uint32_t n = 0;
+
+    if (events.size() < max)
+        events.resize(max);
+
+    for (;;) {
+        count = epoll_wait(lp->epfd, events.data(), (int)max, timeout);
+        if (count < 0) {
+            if (errno != EINTR)
+                return -1;
+            count = 0;
+        }
+
+        /*real events first, each takes at most one of the max slots*/
+        for (i = 0, wake = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                wake = 1;
+                continue;
+            }
+            np = (plinux_poll)((pepoll_poll)events[i].data.ptr)->blob;
+            if (np->io) {
+                n += _linux_iodone(lp, (pepoll_poll)events[i].data.ptr, out + n);
+                continue;
+            }
+            armed = 1;
+            if (!np->armed.compare_exchange_strong(armed, 0))
+                continue;
+            out[n].poll = (pepoll_poll)events[i].data.ptr;
+            out[n].key = 0;
+            out[n].value = 0;
+            out[n++].events = _fromnative(events[i].events);
+        }
+
+        /*one count per posted entry, whoever reads it takes one*/
+        while (wake && n < max && read(lp->wakefd, &value, sizeof value) == sizeof value) {
+            std::lock_guard<std::mutex> lock1(lp->lock);
+            out[n++] = lp->posted.front();
+            lp->posted.pop_front();
+        }
+
+        if (n > 0 || timeout == 0)
+            return (int)n;
+
+        /*everything seen was taken by another waiter, wait out the rest*/
+        if (timeout > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0)
+                return 0;
+            timeout = (int)left;
+        }
+    }
+}
+
+const epoll_backend epoll_backend_linux = {
+    "linux",
+    _linux_create,
+    _linux_destroy,
+    _linux_attach,
+    _linux_detach,
+    _linux_poll,
+    _linux_cancel,
+    _linux_dequeue,
+    _linux_post,
+    _linux_handles,
+    NULL,
+    _linux_submit,
+    _linux_probe,
+    /*cancel removes the fd from the epoll set, it must run before the close*/
+    0
+};
+#endif
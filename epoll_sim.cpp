@@ -0,0 +1,269 @@
+/*@file epoll_sim.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "epoll_sim.h"
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+typedef struct _sim_port {
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<epoll_completion> queue;
+    uint32_t sockets;
+} sim_port, *psim_port;
+
+typedef struct _sim_poll {
+    uint32_t events;
+    int armed;
+} sim_poll, *psim_poll;
+
+typedef struct _sim_waiter {
+    pepoll_port port;
+    pepoll_poll poll;
+} sim_waiter;
+
+typedef struct _sim_socket {
+    uint32_t ready;
+    std::vector<sim_waiter> armed;
+} sim_socket, *psim_socket;
+
+static_assert(sizeof(sim_poll) <= EPOLL_POLL_BLOB, "sim_poll does not fit EPOLL_POLL_BLOB");
+
+/*sockets and the armed state of every poll, taken before a port lock*/
+static std::mutex simlock;
+static std::unordered_map<uint64_t, psim_socket> simsockets;
+/*below 1 << FDTABLE_INDEX_BITS so the Linux identity fd mapping holds*/
+static uint64_t simnext = 0x10000;
+static std::atomic<uint64_t> simpolls(0);
+static std::atomic<uint64_t> simposts(0);
+
+static void _sim_push(pepoll_port port, pepoll_poll p, uintptr_t key, uint32_t value, uint32_t events) {
+    psim_port sp = (psim_port)port->handle;
+    epoll_completion c;
+
+    c.poll = p;
+    c.key = key;
+    c.value = value;
+    c.events = events;
+    {
+        std::lock_guard<std::mutex> lock1(sp->lock);
+        sp->queue.push_back(c);
+    }
+    sp->cv.notify_one();
+}
+
+/*caller holds simlock*/
+static void _sim_complete(psim_socket ss, uint32_t events, int all) {
+    size_t n = 0;
+
+    while (n < ss->armed.size()) {
+        sim_waiter w = ss->armed[n];
+        psim_poll pp = (psim_poll)w.poll->blob;
+        uint32_t fired = all ? events : pp->events & events;
+
+        if (fired == 0) {
+            n++;
+            continue;
+        }
+        ss->armed.erase(ss->armed.begin() + n);
+        pp->armed = 0;
+        _sim_push(w.port, w.poll, 0, 0, fired);
+    }
+}
+
+static int _sim_create(pepoll_port port) {
+    psim_port sp = new (std::nothrow) sim_port();
+    if (sp == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    port->handle = sp;
+    return 0;
+}
+
+static void _sim_destroy(pepoll_port port) {
+    delete (psim_port)port->handle;
+    port->handle = NULL;
+}
+
+static int _sim_attach(pepoll_port port, pepoll_poll p, uint64_t socket) {
+    std::lock_guard<std::mutex> lock1(simlock);
+    if (simsockets.find(socket) == simsockets.end()) {
+        errno = EBADF;
+        return -1;
+    }
+    new (p->blob) sim_poll();
+    p->socket = socket;
+    ((psim_port)port->handle)->sockets++;
+    return 0;
+}
+
+static void _sim_detach(pepoll_port port, pepoll_poll p) {
+    (void)p;
+    ((psim_port)port->handle)->sockets--;
+}
+
+static void _sim_handles(pepoll_port port, uint32_t* handles, uint32_t* sockets) {
+    *handles = 0;
+    *sockets = ((psim_port)port->handle)->sockets;
+}
+
+static int _sim_poll(pepoll_port port, pepoll_poll p, uint32_t events) {
+    psim_poll pp = (psim_poll)p->blob;
+    std::lock_guard<std::mutex> lock1(simlock);
+    auto it = simsockets.find(p->socket);
+
+    if (it == simsockets.end())
+        return EPOLL_POLL_GONE;
+
+    simpolls++;
+    pp->events = events;
+    if (it->second->ready & events) {
+        _sim_push(port, p, 0, 0, it->second->ready & events);
+        return 0;
+    }
+
+    pp->armed = 1;
+    it->second->armed.push_back({ port, p });
+    return 0;
+}
+
+static int _sim_cancel(pepoll_port port, pepoll_poll p) {
+    psim_poll pp = (psim_poll)p->blob;
+    std::lock_guard<std::mutex> lock1(simlock);
+    auto it = simsockets.find(p->socket);
+
+    if (!pp->armed || it == simsockets.end()) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    std::vector<sim_waiter>& armed = it->second->armed;
+    for (size_t n = 0; n < armed.size(); n++) {
+        if (armed[n].poll == p) {
+            armed.erase(armed.begin() + n);
+            break;
+        }
+    }
+    pp->armed = 0;
+    _sim_push(port, p, 0, 0, 0);
+    return 0;
+}
+
+static uint32_t _sim_probe(pepoll_port port, pepoll_poll p, uint32_t events) {
+    (void)port;
+    std::lock_guard<std::mutex> lock1(simlock);
+    auto it = simsockets.find(p->socket);
+    return it != simsockets.end() ? it->second->ready & events : 0;
+}
+
+static int _sim_dequeue(pepoll_port port, pepoll_completion out, uint32_t max, int timeout) {
+    psim_port sp = (psim_port)port->handle;
+    std::unique_lock<std::mutex> lock1(sp->lock);
+    uint32_t n;
+
+    if (timeout < 0)
+        sp->cv.wait(lock1, [sp] { return !sp->queue.empty(); });
+    else if (!sp->cv.wait_for(lock1, std::chrono::milliseconds(timeout), [sp] { return !sp->queue.empty(); }))
+        return 0;
+
+    for (n = 0; n < max && !sp->queue.empty(); n++) {
+        out[n] = sp->queue.front();
+        sp->queue.pop_front();
+    }
+    return (int)n;
+}
+
+static int _sim_post(pepoll_port port, pepoll_poll p, uintptr_t key, uint32_t value) {
+    simposts++;
+    _sim_push(port, p, key, value, 0);
+    return 0;
+}
+
+const epoll_backend epoll_backend_sim = {
+    "sim",
+    _sim_create,
+    _sim_destroy,
+    _sim_attach,
+    _sim_detach,
+    _sim_poll,
+    _sim_cancel,
+    _sim_dequeue,
+    _sim_post,
+    _sim_handles,
+    NULL,
+    NULL,
+    _sim_probe,
+    1
+};
+
+socket_t epoll_sim_socket(void) {
+    psim_socket ss = new sim_socket();
+    std::lock_guard<std::mutex> lock1(simlock);
+    ss->ready = 0;
+    simsockets[simnext] = ss;
+    simnext += 4;
+    return (socket_t)(simnext - 4);
+}
+
+void epoll_sim_ready(socket_t s, uint32_t events) {
+    std::lock_guard<std::mutex> lock1(simlock);
+    auto it = simsockets.find((uint64_t)s);
+    if (it == simsockets.end())
+        return;
+    it->second->ready |= events;
+    _sim_complete(it->second, it->second->ready, 0);
+}
+
+void epoll_sim_drain(socket_t s, uint32_t events) {
+    std::lock_guard<std::mutex> lock1(simlock);
+    auto it = simsockets.find((uint64_t)s);
+    if (it != simsockets.end())
+        it->second->ready &= ~events;
+}
+
+void epoll_sim_close(socket_t s) {
+    std::lock_guard<std::mutex> lock1(simlock);
+    auto it = simsockets.find((uint64_t)s);
+    if (it == simsockets.end())
+        return;
+    _sim_complete(it->second, AFD_POLL_LOCAL_CLOSE, 1);
+    delete it->second;
+    simsockets.erase(it);
+}
+
+uint64_t epoll_sim_polls(void) {
+    return simpolls.load();
+}
+
+uint64_t epoll_sim_posts(void) {
+    return simposts.load();
+}
@@ -0,0 +1,49 @@
+/*@file epoll_sim.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include "epoll.h"
+#include "epoll_backend.h"
+
+/*
+ * driver side of epoll_backend_sim. Simulated sockets have AFD semantics:
+ * a poll completes at once when issued on a socket that is already ready,
+ * otherwise when readiness appears. Nothing runs on its own, so a test
+ * driving it from one thread is fully reproducible.
+ *
+ * Use with epoll_setbackend(&epoll_backend_sim) and the usual
+ * epoll_sock2fd / epoll_ctl / epoll_wait calls.
+ */
+
+socket_t epoll_sim_socket(void);
+/*readiness appears, polls waiting for any of events complete*/
+void epoll_sim_ready(socket_t s, uint32_t events);
+/*the application consumed it*/
+void epoll_sim_drain(socket_t s, uint32_t events);
+/*outstanding polls complete with AFD_POLL_LOCAL_CLOSE, later ones fail*/
+void epoll_sim_close(socket_t s);
+/*polls issued so far, what a real run would spend in AFD ioctls*/
+uint64_t epoll_sim_polls(void);
+/*entries the engine posted to sim ports so far (wakeups, eventfd completions)*/
+uint64_t epoll_sim_posts(void);
@@ -0,0 +1,411 @@
+/*@file fdtable.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "fdtable.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FDTABLE_GEN_MASK ((1u << FDTABLE_GEN_BITS) - 1)
+#define FDTABLE_HASH_MIN 64
+
+static inline uint32_t _fdindex(int fd) {
+    return (uint32_t)fd & FDTABLE_MAX_INDEX;
+}
+
+static inline uint32_t _fdgen(int fd) {
+    return ((uint32_t)fd >> FDTABLE_INDEX_BITS) & FDTABLE_GEN_MASK;
+}
+
+static inline pfd_slot _fdslot(pfd_table t, uint32_t index) {
+    pfd_slot chunk = t->chunks[index >> FDTABLE_CHUNK_BITS].load(std::memory_order_acquire);
+    if (chunk == NULL)
+        return NULL;
+    return &chunk[index & (FDTABLE_CHUNK_SIZE - 1)];
+}
+
+static inline uint32_t _fdhash(uint64_t key, uint32_t cap) {
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (cap - 1);
+}
+
+static pfd_hashent _hashfind(pfd_table t, uint64_t key) {
+    uint32_t i;
+
+    if (t->hash == NULL)
+        return NULL;
+
+    for (i = _fdhash(key, t->hashcap);; i = (i + 1) & (t->hashcap - 1)) {
+        if (t->hash[i].fd == 0)
+            return NULL;
+        if (t->hash[i].fd > 0 && t->hash[i].key == key)
+            return &t->hash[i];
+    }
+}
+
+static int _hashresize(pfd_table t) {
+    pfd_hashent old = t->hash;
+    uint32_t oldcap = t->hashcap;
+    uint32_t cap = FDTABLE_HASH_MIN;
+    uint32_t i, j;
+
+    while (cap < (t->count + 1) * 4)
+        cap <<= 1;
+
+    t->hash = (pfd_hashent)calloc(cap, sizeof(fd_hashent));
+    if (t->hash == NULL) {
+        t->hash = old;
+        return -1;
+    }
+    t->hashcap = cap;
+    t->hashused = 0;
+
+    for (i = 0; i < oldcap; i++) {
+        if (old[i].fd <= 0)
+            continue;
+        for (j = _fdhash(old[i].key, cap); t->hash[j].fd != 0; j = (j + 1) & (cap - 1));
+        t->hash[j] = old[i];
+        t->hashused++;
+    }
+
+    free(old);
+    return 0;
+}
+
+static int _hashinsert(pfd_table t, uint64_t key, int fd) {
+    uint32_t i;
+
+    if ((t->hashused + 1) * 2 > t->hashcap && _hashresize(t) < 0)
+        return -1;
+
+    for (i = _fdhash(key, t->hashcap); t->hash[i].fd > 0; i = (i + 1) & (t->hashcap - 1));
+    if (t->hash[i].fd == 0)
+        t->hashused++;
+    t->hash[i].key = key;
+    t->hash[i].fd = fd;
+    return 0;
+}
+
+static pfd_slot _slotalloc(pfd_table t, uint32_t* index) {
+    pfd_slot chunk, slot;
+    uint32_t i;
+
+    if (t->freehead != 0) {
+        i = t->freehead;
+        slot = _fdslot(t, i);
+        t->freehead = slot->nextfree;
+        *index = i;
+        return slot;
+    }
+
+    if (t->nextindex == 0)
+        t->nextindex = 1;
+    if (t->nextindex > FDTABLE_MAX_INDEX)
+        return NULL;
+
+    i = t->nextindex;
+    chunk = t->chunks[i >> FDTABLE_CHUNK_BITS].load(std::memory_order_relaxed);
+    if (chunk == NULL) {
+        chunk = (pfd_slot)calloc(FDTABLE_CHUNK_SIZE, sizeof(fd_slot));
+        if (chunk == NULL)
+            return NULL;
+        t->chunks[i >> FDTABLE_CHUNK_BITS].store(chunk, std::memory_order_release);
+    }
+
+    t->nextindex++;
+    *index = i;
+    return &chunk[i & (FDTABLE_CHUNK_SIZE - 1)];
+}
+
+static void _slotfree(pfd_table t, pfd_slot slot, uint32_t index) {
+    uint32_t gen = (slot->tag.load(std::memory_order_relaxed) >> 1) + 1;
+
+    /*retire the generation before the payload so a racing lookup fails*/
+    slot->tag.store((gen & FDTABLE_GEN_MASK) << 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->handle.store(0, std::memory_order_relaxed);
+    slot->data.store(NULL, std::memory_order_relaxed);
+    slot->nextfree = t->freehead;
+    t->freehead = index;
+    t->count--;
+}
+
+int fdtable_insert(pfd_table t, uint64_t handle, void* data) {
+    return fdtable_inserttype(t, handle, 0, data);
+}
+
+int fdtable_inserttype(pfd_table t, uint64_t handle, uint32_t type, void* data) {
+    pfd_hashent ent;
+    pfd_slot slot;
+    uint32_t index, gen;
+    int fd;
+
+    std::lock_guard<std::mutex> lock1(t->lock);
+
+    ent = _hashfind(t, handle);
+    if (ent != NULL)
+        return ent->fd;
+
+    slot = _slotalloc(t, &index);
+    if (slot == NULL)
+        return -1;
+
+    gen = slot->tag.load(std::memory_order_relaxed) >> 1;
+    fd = (int)((gen << FDTABLE_INDEX_BITS) | index);
+
+    if (_hashinsert(t, handle, fd) < 0) {
+        slot->nextfree = t->freehead;
+        t->freehead = index;
+        return -1;
+    }
+
+    slot->key = handle;
+    slot->handle.store(handle, std::memory_order_relaxed);
+    slot->type.store(type, std::memory_order_relaxed);
+    slot->data.store(data, std::memory_order_relaxed);
+    slot->tag.store((gen << 1) | 1, std::memory_order_release);
+    t->count++;
+
+    return fd;
+}
+
+int fdtable_free(pfd_table t, int fd) {
+    pfd_slot slot;
+    pfd_hashent ent;
+
+    if (fd <= 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock1(t->lock);
+
+    slot = _fdslot(t, _fdindex(fd));
+    if (slot == NULL || slot->tag.load(std::memory_order_relaxed) != ((_fdgen(fd) << 1) | 1))
+        return -1;
+
+    ent = _hashfind(t, slot->key);
+    if (ent != NULL)
+        ent->fd = -1;
+
+    _slotfree(t, slot, _fdindex(fd));
+    return 0;
+}
+
+int fdtable_lookup(pfd_table t, int fd, uint64_t* handle, void** data) {
+    pfd_slot slot;
+    uint32_t tag;
+    uint64_t h;
+    void* d;
+
+    if (fd <= 0)
+        return -1;
+
+    slot = _fdslot(t, _fdindex(fd));
+    if (slot == NULL)
+        return -1;
+
+    tag = (_fdgen(fd) << 1) | 1;
+    if (slot->tag.load(std::memory_order_acquire) != tag)
+        return -1;
+
+    h = slot->handle.load(std::memory_order_relaxed);
+    d = slot->data.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->tag.load(std::memory_order_relaxed) != tag)
+        return -1;
+
+    if (handle != NULL)
+        *handle = h;
+    if (data != NULL)
+        *data = d;
+    return 0;
+}
+
+int fdtable_type(pfd_table t, int fd) {
+    pfd_slot slot;
+    uint32_t tag, type;
+
+    if (fd <= 0)
+        return -1;
+
+    slot = _fdslot(t, _fdindex(fd));
+    if (slot == NULL)
+        return -1;
+
+    tag = (_fdgen(fd) << 1) | 1;
+    if (slot->tag.load(std::memory_order_acquire) != tag)
+        return -1;
+
+    type = slot->type.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->tag.load(std::memory_order_relaxed) != tag)
+        return -1;
+    return (int)type;
+}
+
+int fdtable_find(pfd_table t, uint64_t handle) {
+    pfd_hashent ent;
+
+    std::lock_guard<std::mutex> lock1(t->lock);
+    ent = _hashfind(t, handle);
+    if (ent == NULL)
+        return -1;
+    return ent->fd;
+}
+
+int fdtable_sethandle(pfd_table t, int fd, uint64_t handle) {
+    pfd_slot slot;
+
+    if (fd <= 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock1(t->lock);
+    slot = _fdslot(t, _fdindex(fd));
+    if (slot == NULL || slot->tag.load(std::memory_order_relaxed) != ((_fdgen(fd) << 1) | 1))
+        return -1;
+    slot->handle.store(handle, std::memory_order_release);
+    return 0;
+}
+
+int fdtable_setdata(pfd_table t, int fd, void* data) {
+    pfd_slot slot;
+
+    if (fd <= 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock1(t->lock);
+    slot = _fdslot(t, _fdindex(fd));
+    if (slot == NULL || slot->tag.load(std::memory_order_relaxed) != ((_fdgen(fd) << 1) | 1))
+        return -1;
+    slot->data.store(data, std::memory_order_release);
+    return 0;
+}
+
+uint32_t fdtable_count(pfd_table t) {
+    std::lock_guard<std::mutex> lock1(t->lock);
+    return t->count;
+}
+
+void fdtable_clear(pfd_table t, void (*release)(void* data)) {
+    pfd_slot slot;
+    void* data;
+    uint32_t i;
+
+    std::lock_guard<std::mutex> lock1(t->lock);
+
+    for (i = 1; i < t->nextindex; i++) {
+        slot = _fdslot(t, i);
+        if ((slot->tag.load(std::memory_order_relaxed) & 1) == 0)
+            continue;
+        data = slot->data.load(std::memory_order_relaxed);
+        _slotfree(t, slot, i);
+        if (data != NULL && release != NULL)
+            release(data);
+    }
+
+    if (t->hash != NULL)
+        memset(t->hash, 0, t->hashcap * sizeof(fd_hashent));
+    t->hashused = 0;
+}
+
+void fdtable_destroy(pfd_table t) {
+    uint32_t i;
+
+    std::lock_guard<std::mutex> lock1(t->lock);
+
+    for (i = 0; i < FDTABLE_MAX_CHUNKS; i++) {
+        free(t->chunks[i].load(std::memory_order_relaxed));
+        t->chunks[i].store(NULL, std::memory_order_relaxed);
+    }
+    free(t->hash);
+    t->hash = NULL;
+    t->hashcap = t->hashused = 0;
+    t->freehead = t->nextindex = t->count = 0;
+}
+
+void* fdmap_get(pfd_map m, int fd) {
+    std::atomic<void*>* chunk;
+    uint32_t index;
+
+    if (fd <= 0)
+        return NULL;
+
+    index = _fdindex(fd);
+    chunk = m->chunks[index >> FDTABLE_CHUNK_BITS].load(std::memory_order_acquire);
+    if (chunk == NULL)
+        return NULL;
+    return chunk[index & (FDTABLE_CHUNK_SIZE - 1)].load(std::memory_order_acquire);
+}
+
+int fdmap_set(pfd_map m, int fd, void* data) {
+    std::atomic<void*>* chunk;
+    uint32_t index;
+
+    if (fd <= 0)
+        return -1;
+
+    index = _fdindex(fd);
+    chunk = m->chunks[index >> FDTABLE_CHUNK_BITS].load(std::memory_order_acquire);
+    if (chunk == NULL) {
+        if (data == NULL)
+            return 0;
+        std::lock_guard<std::mutex> lock1(m->lock);
+        chunk = m->chunks[index >> FDTABLE_CHUNK_BITS].load(std::memory_order_relaxed);
+        if (chunk == NULL) {
+            chunk = (std::atomic<void*>*)calloc(FDTABLE_CHUNK_SIZE, sizeof(std::atomic<void*>));
+            if (chunk == NULL)
+                return -1;
+            m->chunks[index >> FDTABLE_CHUNK_BITS].store(chunk, std::memory_order_release);
+        }
+    }
+
+    chunk[index & (FDTABLE_CHUNK_SIZE - 1)].store(data, std::memory_order_release);
+    return 0;
+}
+
+void fdmap_clear(pfd_map m, void (*release)(void* data, void* arg), void* arg) {
+    std::atomic<void*>* chunk;
+    void* data;
+    uint32_t i, j;
+
+    for (i = 0; i < FDTABLE_MAX_CHUNKS; i++) {
+        chunk = m->chunks[i].load(std::memory_order_acquire);
+        if (chunk == NULL)
+            continue;
+        for (j = 0; j < FDTABLE_CHUNK_SIZE; j++) {
+            data = chunk[j].exchange(NULL, std::memory_order_acq_rel);
+            if (data != NULL && release != NULL)
+                release(data, arg);
+        }
+    }
+}
+
+void fdmap_destroy(pfd_map m) {
+    uint32_t i;
+
+    std::lock_guard<std::mutex> lock1(m->lock);
+    for (i = 0; i < FDTABLE_MAX_CHUNKS; i++) {
+        free(m->chunks[i].load(std::memory_order_relaxed));
+        m->chunks[i].store(NULL, std::memory_order_relaxed);
+    }
+}
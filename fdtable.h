@@ -0,0 +1,109 @@
+/*@file fdtable.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+/*
+ * fd slot table: maps small int fds to a 64 bit handle, its type and a user
+ * pointer.
+ *
+ * An fd is (generation << FDTABLE_INDEX_BITS | index). Slots live in fixed
+ * size chunks that are never moved or freed while the table is in use, so
+ * fdtable_lookup is wait-free and a stale fd (freed and reused slot) fails
+ * the generation check instead of aliasing the new owner. Allocation pops a
+ * free list, the reverse handle->fd direction is an open addressing hash;
+ * both are only touched with the table lock held.
+ *
+ * A zero-initialized fd_table is a valid empty table.
+ */
+
+#define FDTABLE_INDEX_BITS 21
+#define FDTABLE_GEN_BITS   10
+#define FDTABLE_MAX_INDEX  ((1 << FDTABLE_INDEX_BITS) - 1)
+#define FDTABLE_CHUNK_BITS 12
+#define FDTABLE_CHUNK_SIZE (1 << FDTABLE_CHUNK_BITS)
+#define FDTABLE_MAX_CHUNKS ((FDTABLE_MAX_INDEX >> FDTABLE_CHUNK_BITS) + 1)
+
+typedef struct _fd_slot {
+    std::atomic<uint32_t> tag;      /* generation << 1 | live */
+    std::atomic<uint64_t> handle;
+    std::atomic<uint32_t> type;     /* caller defined kind of handle */
+    std::atomic<void*> data;
+    uint64_t key;                   /* handle the slot is hashed under */
+    uint32_t nextfree;
+} fd_slot, *pfd_slot;
+
+typedef struct _fd_hashent {
+    uint64_t key;
+    int fd;                         /* 0 empty, -1 deleted */
+} fd_hashent, *pfd_hashent;
+
+typedef struct _fd_table {
+    std::atomic<pfd_slot> chunks[FDTABLE_MAX_CHUNKS];
+    std::mutex lock;
+    uint32_t freehead;
+    uint32_t nextindex;
+    uint32_t count;
+    pfd_hashent hash;
+    uint32_t hashcap;
+    uint32_t hashused;
+} fd_table, *pfd_table;
+
+/*
+ * fd keyed pointer map for state that is per owner rather than global
+ * (e.g. the registrations of one epoll instance). Entries are indexed by
+ * the slot index of the fd, so the stored object has to remember its fd
+ * and callers compare it to reject stale generations. Reads are wait-free.
+ */
+typedef struct _fd_map {
+    std::atomic<std::atomic<void*>*> chunks[FDTABLE_MAX_CHUNKS];
+    std::mutex lock;
+} fd_map, *pfd_map;
+
+/*returns the fd mapped to handle, allocating a new slot when there is none*/
+int fdtable_insert(pfd_table t, uint64_t handle, void* data);
+/*as fdtable_insert, a new slot is tagged with type (fdtable_insert uses 0)*/
+int fdtable_inserttype(pfd_table t, uint64_t handle, uint32_t type, void* data);
+int fdtable_free(pfd_table t, int fd);
+/*wait-free, either output may be NULL*/
+int fdtable_lookup(pfd_table t, int fd, uint64_t* handle, void** data);
+int fdtable_find(pfd_table t, uint64_t handle);
+/*wait-free, the type of a live fd or -1*/
+int fdtable_type(pfd_table t, int fd);
+int fdtable_sethandle(pfd_table t, int fd, uint64_t handle);
+int fdtable_setdata(pfd_table t, int fd, void* data);
+uint32_t fdtable_count(pfd_table t);
+/*frees every live slot, release is called for slots holding data*/
+void fdtable_clear(pfd_table t, void (*release)(void* data));
+/*releases the table memory, no lookups may run concurrently*/
+void fdtable_destroy(pfd_table t);
+
+void* fdmap_get(pfd_map m, int fd);
+int fdmap_set(pfd_map m, int fd, void* data);
+/*calls release for every entry and empties the map*/
+void fdmap_clear(pfd_map m, void (*release)(void* data, void* arg), void* arg);
+void fdmap_destroy(pfd_map m);
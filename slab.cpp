@@ -0,0 +1,165 @@
+/*@file slab.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "slab.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define SLAB_MPOL_PREFERRED 1
+#endif
+
+/*
+ * memory for a slab, placed on node when it is not -1. *mapped gets the
+ * size when it did not come from the heap. A kernel without NUMA support
+ * refuses the policy and the pages land wherever they are first touched.
+ */
+static void* _slabmem(size_t size, int node, size_t* mapped) {
+    *mapped = 0;
+#ifdef _WIN32
+    if (node >= 0) {
+        void* mem = VirtualAllocExNuma(GetCurrentProcess(), NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, (DWORD)node);
+        if (mem != NULL) {
+            *mapped = size;
+            return mem;
+        }
+    }
+#elif defined(__linux__)
+    unsigned long mask[4] = { 0 };
+    const int bits = (int)(sizeof(mask[0]) * 8);
+
+    if (node >= 0 && node < bits * 4) {
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) {
+            mask[node / bits] |= 1UL << (node % bits);
+            syscall(SYS_mbind, mem, size, SLAB_MPOL_PREFERRED, mask, (unsigned long)(bits * 4 + 1), 0);
+            *mapped = size;
+            return mem;
+        }
+    }
+#else
+    (void)node;
+#endif
+    return malloc(size);
+}
+
+static void _slabrelease(void* mem, size_t mapped) {
+    if (mapped == 0) {
+        free(mem);
+        return;
+    }
+#ifdef _WIN32
+    VirtualFree(mem, 0, MEM_RELEASE);
+#elif defined(__linux__)
+    munmap(mem, mapped);
+#endif
+}
+
+static int _slabgrow(pslab_pool pool) {
+    pslab_hdr hdr;
+    char* mem;
+    char* obj;
+    size_t mapped;
+    uint32_t i;
+
+    mem = (char*)_slabmem(sizeof(slab_hdr) + pool->objsize * pool->perslab + SLAB_CACHELINE, pool->node, &mapped);
+    if (mem == NULL)
+        return -1;
+
+    hdr = (pslab_hdr)mem;
+    hdr->mem = mem;
+    hdr->mapped = mapped;
+    hdr->next = pool->slabs;
+    pool->slabs = hdr;
+
+    obj = (char*)(((uintptr_t)(mem + sizeof(slab_hdr)) + SLAB_CACHELINE - 1) & ~(uintptr_t)(SLAB_CACHELINE - 1));
+
+    /*push in reverse so allocations walk the slab front to back*/
+    for (i = pool->perslab; i > 0; i--) {
+        *(void**)(obj + (size_t)(i - 1) * pool->objsize) = pool->freelist;
+        pool->freelist = obj + (size_t)(i - 1) * pool->objsize;
+    }
+
+    pool->nslabs++;
+    pool->capacity += pool->perslab;
+    return 0;
+}
+
+void slab_init(pslab_pool pool, size_t objsize, uint32_t perslab) {
+    memset(pool, 0, sizeof(*pool));
+    if (objsize < sizeof(void*))
+        objsize = sizeof(void*);
+    pool->objsize = (objsize + SLAB_CACHELINE - 1) & ~(size_t)(SLAB_CACHELINE - 1);
+    pool->perslab = perslab ? perslab : 1;
+    pool->node = -1;
+}
+
+int slab_reserve(pslab_pool pool, uint32_t count) {
+    while (pool->capacity - pool->inuse < count) {
+        if (_slabgrow(pool) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+void* slab_alloc(pslab_pool pool) {
+    void* obj;
+
+    if (pool->freelist == NULL && _slabgrow(pool) < 0)
+        return NULL;
+
+    obj = pool->freelist;
+    pool->freelist = *(void**)obj;
+    pool->inuse++;
+    memset(obj, 0, pool->objsize);
+    return obj;
+}
+
+void slab_free(pslab_pool pool, void* obj) {
+    if (obj == NULL)
+        return;
+    *(void**)obj = pool->freelist;
+    pool->freelist = obj;
+    pool->inuse--;
+}
+
+void slab_destroy(pslab_pool pool) {
+    pslab_hdr hdr;
+    int node = pool->node;
+
+    while ((hdr = pool->slabs) != NULL) {
+        pool->slabs = hdr->next;
+        _slabrelease(hdr->mem, hdr->mapped);
+    }
+    slab_init(pool, pool->objsize, pool->perslab);
+    pool->node = node;
+}
+
+void slab_setnode(pslab_pool pool, int node) {
+    pool->node = node;
+}
@@ -0,0 +1,64 @@
+/*@file slab.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * fixed size object pool. Objects are carved out of slabs of perslab
+ * entries, each entry starts on its own cache line, and freed entries go
+ * on a LIFO free list so the next allocation reuses the warmest record.
+ * Slabs are only returned to the heap by slab_destroy. Not thread-safe,
+ * the owner serializes access.
+ */
+
+#define SLAB_CACHELINE 64
+
+typedef struct _slab_hdr {
+    struct _slab_hdr* next;
+    void* mem;
+    size_t mapped;      /* size of a slab placed on a node, 0 when from the heap */
+} slab_hdr, *pslab_hdr;
+
+typedef struct _slab_pool {
+    size_t objsize;
+    uint32_t perslab;
+    void* freelist;
+    pslab_hdr slabs;
+    uint32_t nslabs;
+    uint32_t capacity;
+    uint32_t inuse;
+    int node;           /* NUMA node new slabs are placed on, -1 anywhere */
+} slab_pool, *pslab_pool;
+
+void slab_init(pslab_pool pool, size_t objsize, uint32_t perslab);
+/*makes sure at least count objects can be allocated without growing*/
+int slab_reserve(pslab_pool pool, uint32_t count);
+/*returns a zeroed object or NULL*/
+void* slab_alloc(pslab_pool pool);
+void slab_free(pslab_pool pool, void* obj);
+void slab_destroy(pslab_pool pool);
+/*slabs grown from now on are placed on a NUMA node, best effort*/
+void slab_setnode(pslab_pool pool, int node);
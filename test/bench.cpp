@@ -25,19 +25,33 @@
 #include "../epoll.h"
 #include "third_party/socketpair.h"
 #include "third_party/select.h"
+#include "histogram.h"
 
 #include <iostream>
 #include <csignal>
 #include <stdio.h>
+#include <string.h>
 #include <chrono>
 #include <ctime>
 #include <cmath>
 #include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
+#ifdef _MSC_VER
 #pragma comment(lib, "ws2_32.lib")
+#endif
 
 static void runbench();
 static void epolldispatch();
+static void runbatchbench();
+static void runexclusivebench();
+static void runctlbatchbench();
+static void runtimeoutbench();
 
 static size_t con = 0;
 static size_t writes = 0;
@@ -48,44 +62,84 @@ static int ncount = 0;
 static int errcount = 0;
 std::chrono::time_point<std::chrono::high_resolution_clock> startick;
 std::chrono::time_point<std::chrono::high_resolution_clock> endtick;
-static intptr_t difftick = 0;
-static char method[10] = { 0 };
+static char method[16] = { 0 };
 static int m = 0;
+/*lazy method: the epoll ping-pong on an EPOLL_LAZY instance*/
+static int lazy = 0;
 
-struct socketpair
+struct sockpair
 {
     SOCKET s1;
     SOCKET s2;
 };
-std::map<int, socketpair> ms;
+std::map<int, sockpair> ms;
 
-static struct timeval ts, te;
 static int epfd;
 
+/*
+ * load scenarios: writer threads keep one message in flight on each active
+ * pair while waiter threads harvest, time the wakeup (send to epoll_wait
+ * return) into an HDR histogram and read the message.
+ */
+#define LOAD_WRITERS 4
+#define LOAD_WAITERS 2
+
+typedef struct _loadscenario {
+    const char* name;
+    size_t msgsize;
+    size_t activediv;   /*1 in activediv pairs carries traffic*/
+    int churn;          /*ADD before each message, DEL once it is read*/
+    int busypoll;       /*epoll_wait with timeout 0 instead of blocking*/
+    int createflags;    /*epoll_create1 flags*/
+    uint32_t spinus;    /*epoll_setbusypoll budget*/
+    int adaptive;
+    int affinity;       /*pair i goes to worker i % LOAD_WAITERS, waiter w is worker w*/
+    int readchunk;      /*bytes read per event, 0 reads until EAGAIN*/
+} loadscenario;
+
+static const loadscenario loadscenarios[] = {
+    { "writers",  1,     1,   0, 0, 0,             0,   0, 0, 0 },
+    { "bulk",     16384, 1,   0, 0, 0,             0,   0, 0, 0 },
+    { "churn",    1,     1,   1, 0, 0,             0,   0, 0, 0 },
+    { "idle",     1,     100, 0, 0, 0,             0,   0, 0, 0 },
+    { "grouped",  1,     100, 0, 0, EPOLL_GROUPED, 0,   0, 0, 0 },
+    { "sharded",  1,     1,   0, 0, EPOLL_SHARDED, 0,   0, 0, 0 },
+    { "affinity", 1,     1,   0, 0, EPOLL_SHARDS(LOAD_WAITERS), 0, 0, 1, 0 },
+    { "busypoll", 1,     1,   0, 1, 0,             0,   0, 0, 0 },
+    { "spin",     1,     1,   0, 0, 0,             200, 0, 0, 0 },
+    { "adaptive", 1,     1,   0, 0, 0,             200, 1, 0, 0 },
+    { "chunked",  16384, 1,   0, 0, 0,             0,   0, 0, 4096 },
+    { "lazychunked", 16384, 1, 0, 0, EPOLL_LAZY,   0,   0, 0, 4096 },
+};
+
+static const loadscenario* findscenario(const char* name);
+static void runloadbench(const loadscenario* sc);
+
 int main(int argc, char* argv[])
 {
-    if (argc < 3) {
+    if (argc < 4) {
         std::cout << std::endl;
         std::cout << "Usage:" << std::endl;
-        std::cout << "bench.exe <connections> <writes> <methods: select or epoll>" << std::endl;
+        std::cout << "bench <connections> <writes> <methods: select, epoll, lazy, batch, exclusive or ctlbatch>" << std::endl;
+        std::cout << "bench <connections> <messages> <scenarios: writers, bulk, churn, idle, grouped, sharded, affinity, busypoll, spin, adaptive, chunked or lazychunked>" << std::endl;
+        std::cout << "bench <timeout usec> <waits> timeout" << std::endl;
         std::cout << std::endl;
-        system("pause");
         return -1;
     }
 
-    sprintf_s(method, 10, "%s", argv[3]);
+    snprintf(method, sizeof method, "%s", argv[3]);
     con = atoi(argv[1]);
     writes = atoi(argv[2]);
 
-    if (strcmp(method, "select") != 0 && strcmp(method, "epoll") != 0) {
-        std::cout << "Invalid " << method << " entered, available methods are select or epoll." << std::endl;
-        system("pause");
+    if (strcmp(method, "select") != 0 && strcmp(method, "epoll") != 0 && strcmp(method, "lazy") != 0 && strcmp(method, "batch") != 0 && strcmp(method, "exclusive") != 0 &&
+        strcmp(method, "ctlbatch") != 0 && strcmp(method, "timeout") != 0 &&
+        findscenario(method) == NULL) {
+        std::cout << "Invalid " << method << " entered, available methods are select, epoll, lazy, batch, exclusive, ctlbatch, timeout, writers, bulk, churn, idle, grouped, sharded, affinity, busypoll, spin, adaptive, chunked or lazychunked." << std::endl;
         return -1;
     }
 
     if (!con || !writes) {
         std::cout << "connections and writes should be positive values." << std::endl;
-        system("pause");
         return -1;
     }
 
@@ -93,6 +147,20 @@ int main(int argc, char* argv[])
         m = 0;
     else if (strcmp(method, "epoll") == 0)
         m = 1;
+    else if (strcmp(method, "lazy") == 0) {
+        m = 1;
+        lazy = 1;
+    }
+    else if (strcmp(method, "batch") == 0)
+        m = 2;
+    else if (strcmp(method, "exclusive") == 0)
+        m = 3;
+    else if (strcmp(method, "ctlbatch") == 0)
+        m = 5;
+    else if (strcmp(method, "timeout") == 0)
+        m = 6;
+    else
+        m = 4;
 
     std::cout << "<<<" << method << " method benchmark >>>" << std::endl;
 
@@ -101,8 +169,40 @@ int main(int argc, char* argv[])
     WSAStartup(0x0202, &WSAData);
 #endif
 
-    if (m == 1) {
-        epfd = epoll_create1(0);
+    if (m == 4) {
+        runloadbench(findscenario(method));
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 0;
+    }
+
+    if (m == 5) {
+        runctlbatchbench();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 0;
+    }
+
+    if (m == 6) {
+        runtimeoutbench();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 0;
+    }
+
+    if (m == 3) {
+        runexclusivebench();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return 0;
+    }
+
+    if (m >= 1) {
+        epfd = epoll_create1(lazy ? EPOLL_LAZY : 0);
         if (epfd == -1) 
         {
             printf("epoll_create1 failed, errno:%d", errno);
@@ -116,20 +216,20 @@ int main(int argc, char* argv[])
         initselect();
     }
 
-    for (int n = 0; n < con; n++) {
+    for (int n = 0; n < (int)con; n++) {
 
         SOCKET s[2];
         if (int err = dumb_socketpair(s, 0) != 0) {
             printf("socketpair failed, connections:%d err:%d %d.\n", n + 1, err, WSAGetLastError());
             break;
         }
-        socketpair spair;
+        sockpair spair;
         spair.s1 = s[0];
         spair.s2 = s[1];
 
-        ms.insert(std::pair<int, socketpair>(n, spair));
+        ms.insert(std::pair<int, sockpair>(n, spair));
 
-        if (m == 1) {
+        if (m >= 1) {
             epoll_event _event = {};
             _event.events = EPOLLIN;
             _event.data.fd = epoll_sock2fd(s[0]);
@@ -144,28 +244,39 @@ int main(int argc, char* argv[])
         }
     }
 
-    size_t average = 0;
-
-    for (int n = 0; n < 10; n++) {
-        runbench();
-        auto dur = std::chrono::duration_cast<std::chrono::microseconds>(endtick - startick).count();
-        average += dur;
-        printf("Writes/Read:%lld/%lld Dispatch:%lld Error:%d Result:%lld usec.\n", twrites, treads, dispatchcounts, errcount, dur);
+    if (m == 2) {
+        runbatchbench();
     }
+    else {
+        size_t average = 0;
+
+        for (int n = 0; n < 10; n++) {
+            runbench();
+            auto dur = std::chrono::duration_cast<std::chrono::microseconds>(endtick - startick).count();
+            average += dur;
+            printf("Writes/Read:%zu/%zu Dispatch:%zu Error:%d Result:%lld usec.\n", twrites, treads, dispatchcounts, errcount, (long long)dur);
+        }
+
+        printf("Average Result:%zu usec.\n", average / 10);
 
-    printf("Average Result:%lld usec.\n", average / 10);
+        /*polls are AFD ioctls on Windows, epoll_ctl calls on Linux*/
+        struct epoll_stats st;
+        if (m == 1 && epoll_stats(epfd, &st) == 0)
+            printf("Polls/message:%.2f Probes/message:%.2f\n",
+                (double)st.polls / (writes * 10), (double)st.probes / (writes * 10));
+    }
 
-    std::map <int, socketpair>::iterator iter;
+    std::map <int, sockpair>::iterator iter;
     for (iter = ms.begin(); iter != ms.end(); iter++) {
-		if (m == 1) {
+		if (m >= 1) {
 			epoll_ctl(epfd, EPOLL_CTL_DEL, epoll_sock2fd(iter->second.s1), NULL);
 		}
         closesocket(iter->second.s1);
         closesocket(iter->second.s2);
     }
 
-    if (m == 1) {
-        close(epfd);
+    if (m >= 1) {
+        epoll_close(epfd);
     }
     ms.clear();
 #ifdef _WIN32
@@ -185,6 +296,9 @@ static void epolldispatch() {
             if (_event[n].events & EPOLLIN) {
                 SOCKET s = epoll_fd2sock(_event[n].data.fd);
                 readcb(s);
+                /*the one byte in flight was read, poll it again without probing*/
+                if (lazy)
+                    epoll_drained(epfd, _event[n].data.fd);
             }
         }
     }
@@ -221,6 +335,444 @@ static void runbench() {
     endtick = std::chrono::high_resolution_clock::now();
 }
 
+/*
+ * makes every connection readable at once and harvests the events with
+ * growing maxevents, reporting how many events each epoll_wait returned.
+ */
+static void runbatchbench() {
+    std::vector<epoll_event> _event(4096);
+    char rbuf[1];
+
+    for (int batch = 1; batch <= 4096; batch *= 2) {
+        size_t harvested = 0;
+        size_t calls = 0;
+        size_t empty = 0;
+
+        for (size_t n = 0; n < ms.size(); n++) {
+            send(ms[(int)n].s2, ".", 1, 0);
+        }
+
+        startick = std::chrono::high_resolution_clock::now();
+
+        while (harvested < ms.size()) {
+            int fds = epoll_wait(epfd, _event.data(), batch, 0);
+            if (fds == -1) {
+                printf("epoll_wait failed, errno %d", errno);
+                return;
+            }
+            if (fds == 0) {
+                empty++;
+                continue;
+            }
+            calls++;
+            for (int n = 0; n < fds; n++) {
+                recv(epoll_fd2sock(_event[n].data.fd), rbuf, 1, 0);
+            }
+            harvested += fds;
+        }
+
+        endtick = std::chrono::high_resolution_clock::now();
+        auto dur = std::chrono::duration_cast<std::chrono::microseconds>(endtick - startick).count();
+        printf("Batch:%d Events:%zu Calls:%zu Empty:%zu Events/Call:%.2f Result:%lld usec.\n",
+            batch, harvested, calls, empty, (double)harvested / calls, (long long)dur);
+    }
+}
+
+/*
+ * one socket watched by <connections> epoll instances with a thread blocked
+ * in each, counts how many threads wake per readiness event with and
+ * without EPOLLEXCLUSIVE.
+ */
+static void runexclusivebench() {
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t flags = pass == 0 ? 0 : EPOLLEXCLUSIVE;
+        std::vector<int> epfds(con);
+        std::vector<std::thread> workers;
+        std::atomic<size_t> wakeups(0);
+        std::atomic<size_t> consumed(0);
+        std::atomic<int> stop(0);
+        SOCKET s[2];
+
+        if (dumb_socketpair(s, 0) != 0) {
+            printf("socketpair failed, err:%d.\n", WSAGetLastError());
+            return;
+        }
+        setnonblocking(s[0]);
+        int fd = epoll_sock2fd(s[0]);
+
+        for (size_t n = 0; n < con; n++) {
+            epoll_event _event = {};
+            _event.events = EPOLLIN | flags;
+            _event.data.fd = fd;
+            epfds[n] = epoll_create1(0);
+            if (epfds[n] == -1 || epoll_ctl(epfds[n], EPOLL_CTL_ADD, fd, &_event) == -1) {
+                printf("epoll_ctl (%zu), failed to add fd %d errno:%d\n", n, fd, errno);
+                return;
+            }
+        }
+
+        for (size_t n = 0; n < con; n++) {
+            workers.emplace_back([&, n]() {
+                epoll_event _event[1];
+                char rbuf[1];
+                while (stop.load() == 0) {
+                    if (epoll_wait(epfds[n], _event, 1, 100) < 1)
+                        continue;
+                    wakeups++;
+                    if (recv(s[0], rbuf, 1, 0) == 1)
+                        consumed++;
+                }
+            });
+        }
+
+        /*let every worker block before the first event*/
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        startick = std::chrono::high_resolution_clock::now();
+
+        for (size_t w = 0; w < writes; w++) {
+            send(s[1], ".", 1, 0);
+            while (consumed.load() <= w)
+                std::this_thread::yield();
+        }
+
+        endtick = std::chrono::high_resolution_clock::now();
+        stop = 1;
+        for (auto& worker : workers)
+            worker.join();
+
+        auto dur = std::chrono::duration_cast<std::chrono::microseconds>(endtick - startick).count();
+        printf("Exclusive:%s Waiters:%zu Events:%zu Wakeups:%zu Wakeups/Event:%.2f Result:%lld usec.\n",
+            pass == 0 ? "no" : "yes", con, writes, wakeups.load(), (double)wakeups.load() / writes, (long long)dur);
+
+        for (size_t n = 0; n < con; n++) {
+            epoll_ctl(epfds[n], EPOLL_CTL_DEL, fd, NULL);
+            epoll_close(epfds[n]);
+        }
+        epoll_freefd(fd);
+        closesocket(s[0]);
+        closesocket(s[1]);
+    }
+}
+
+/*
+ * registers <connections> sockets and deletes them again, <writes> times,
+ * once with an epoll_ctl call per socket and once with epoll_ctl_batch.
+ */
+static void runctlbatchbench() {
+    std::vector<SOCKET> socks;
+    std::vector<epoll_ctl_op> ops(con);
+    std::vector<int> results(con);
+    SOCKET s[2];
+
+    for (size_t n = 0; n < con; n++) {
+        if (dumb_socketpair(s, 0) != 0) {
+            printf("socketpair failed, connections:%zu err:%d.\n", n + 1, WSAGetLastError());
+            con = n;
+            break;
+        }
+        socks.push_back(s[0]);
+        socks.push_back(s[1]);
+        ops[n].fd = epoll_sock2fd(s[0]);
+        ops[n].event.events = EPOLLIN;
+        ops[n].event.data.fd = ops[n].fd;
+    }
+
+    epfd = epoll_create1(0);
+
+    for (int pass = 0; pass < 2; pass++) {
+        struct epoll_handleinfo handles = {};
+        long long add = 0, del = 0;
+        int failed = 0;
+
+        for (size_t w = 0; w < writes; w++) {
+            startick = std::chrono::high_resolution_clock::now();
+            if (pass == 0) {
+                for (size_t n = 0; n < con; n++)
+                    failed += epoll_ctl(epfd, EPOLL_CTL_ADD, ops[n].fd, &ops[n].event) < 0;
+            }
+            else {
+                for (size_t n = 0; n < con; n++)
+                    ops[n].op = EPOLL_CTL_ADD;
+                failed += (int)con - epoll_ctl_batch(epfd, ops.data(), (int)con, results.data());
+            }
+            endtick = std::chrono::high_resolution_clock::now();
+            add += std::chrono::duration_cast<std::chrono::microseconds>(endtick - startick).count();
+            epoll_handleinfo(epfd, &handles);
+
+            startick = std::chrono::high_resolution_clock::now();
+            if (pass == 0) {
+                for (size_t n = 0; n < con; n++)
+                    failed += epoll_ctl(epfd, EPOLL_CTL_DEL, ops[n].fd, NULL) < 0;
+            }
+            else {
+                for (size_t n = 0; n < con; n++)
+                    ops[n].op = EPOLL_CTL_DEL;
+                failed += (int)con - epoll_ctl_batch(epfd, ops.data(), (int)con, results.data());
+            }
+            endtick = std::chrono::high_resolution_clock::now();
+            del += std::chrono::duration_cast<std::chrono::microseconds>(endtick - startick).count();
+        }
+
+        printf("Ctl:%s Sockets:%zu Rounds:%zu Failed:%d Add:%lld usec Del:%lld usec Adds/sec:%.0f Handles:%u\n",
+            pass == 0 ? "percall" : "batch", con, writes, failed, add, del,
+            add > 0 ? con * writes * 1e6 / add : 0.0, handles.handles);
+    }
+
+    epoll_close(epfd);
+    for (size_t n = 0; n < con; n++)
+        epoll_freefd(ops[n].fd);
+    for (size_t n = 0; n < socks.size(); n++)
+        closesocket(socks[n]);
+}
+
+struct loadpair {
+    SOCKET s[2];
+    int fd;
+    int worker;         /*epoll_ctl_affinity worker, -1 none*/
+    /*waiter that handled the last message, a change is a cross-thread handoff*/
+    std::atomic<int> waiter;
+    /*send time of the message in flight, cleared by the waiter that times it*/
+    std::atomic<uint64_t> sent;
+    std::atomic<int> inflight;
+    std::atomic<size_t> received;
+};
+
+static uint64_t loadnow() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*process cpu time (user + system) in usec*/
+static uint64_t loadcputime() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user))
+        return 0;
+    return ((((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+        (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) / 10;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#endif
+}
+
+/*
+ * timeout overshoot: idle waits of con usec, with epoll_wait (timeout
+ * rounded up to ms) and with epoll_pwait2, how late each one returns
+ */
+static void runtimeoutbench() {
+    epoll_event _event[1];
+    struct timespec ts = {};
+    histogram hist;
+    uint64_t start, cpu;
+    int early;
+
+    epfd = epoll_create1(0);
+    if (epfd == -1) {
+        printf("epoll_create1 failed, errno:%d\n", errno);
+        return;
+    }
+
+    ts.tv_sec = (time_t)(con / 1000000);
+    ts.tv_nsec = (long)(con % 1000000) * 1000;
+    for (int hires = 0; hires < 2; hires++) {
+        hist_init(&hist);
+        early = 0;
+        cpu = loadcputime();
+        for (size_t n = 0; n < writes; n++) {
+            start = epoll_clock();
+            if (hires)
+                epoll_pwait2(epfd, _event, 1, &ts, NULL);
+            else
+                epoll_wait(epfd, _event, 1, (int)((con + 999) / 1000));
+            start = epoll_clock() - start;
+            if (start < con * 1000)
+                early++;
+            else
+                hist_record(&hist, start - con * 1000);
+        }
+        cpu = loadcputime() - cpu;
+        printf("Wait:%s Timeout:%zu usec Waits:%zu Early:%d Overshoot usec p50:%.1f p99:%.1f p99.9:%.1f max:%.1f CPU usec/wait:%.1f\n",
+            hires ? "epoll_pwait2" : "epoll_wait", con, writes, early, hist_percentile(&hist, 50) / 1e3, hist_percentile(&hist, 99) / 1e3,
+            hist_percentile(&hist, 99.9) / 1e3, hist.max / 1e3, (double)cpu / writes);
+    }
+    epoll_close(epfd);
+}
+
+static int loadadd(loadpair* p) {
+    epoll_event _event = {};
+    _event.events = EPOLLIN;
+    _event.data.ptr = p;
+    if (p->worker >= 0)
+        return epoll_ctl_affinity(epfd, EPOLL_CTL_ADD, p->fd, &_event, p->worker);
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, p->fd, &_event);
+}
+
+static const loadscenario* findscenario(const char* name) {
+    for (size_t n = 0; n < sizeof(loadscenarios) / sizeof(loadscenarios[0]); n++) {
+        if (strcmp(loadscenarios[n].name, name) == 0)
+            return &loadscenarios[n];
+    }
+    return NULL;
+}
+
+static void runloadbench(const loadscenario* sc) {
+    std::vector<loadpair> pairs(con);
+    std::vector<loadpair*> active;
+    std::vector<histogram> hists(LOAD_WAITERS);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> issued(0);
+    std::atomic<size_t> done(0);
+    std::atomic<size_t> events(0);
+    std::atomic<size_t> handoffs(0);
+    std::atomic<int> errors(0);
+    std::vector<char> msg(sc->msgsize, '.');
+    histogram all;
+    uint64_t cpu;
+    size_t n;
+
+    epfd = epoll_create1(sc->createflags);
+    if (epfd == -1) {
+        printf("epoll_create1 failed, errno:%d\n", errno);
+        return;
+    }
+
+    if (sc->spinus != 0) {
+        epoll_busypoll bp = {};
+        bp.usecs = sc->spinus;
+        bp.adaptive = sc->adaptive;
+        epoll_setbusypoll(epfd, &bp);
+    }
+
+    for (n = 0; n < con; n++) {
+        loadpair* p = &pairs[n];
+        if (dumb_socketpair(p->s, 0) != 0) {
+            printf("socketpair failed, connections:%zu err:%d.\n", n + 1, WSAGetLastError());
+            con = n;
+            break;
+        }
+        setnonblocking(p->s[0]);
+        p->fd = epoll_sock2fd(p->s[0]);
+        p->worker = sc->affinity ? (int)(n % LOAD_WAITERS) : -1;
+        p->waiter = -1;
+        p->sent = 0;
+        p->inflight = 0;
+        p->received = 0;
+        if (!sc->churn && loadadd(p) == -1) {
+            printf("epoll_ctl (%zu), failed to add fd %d errno:%d\n", n, p->fd, errno);
+            con = n + 1;
+            break;
+        }
+        if (n % sc->activediv == 0)
+            active.push_back(p);
+    }
+
+    startick = std::chrono::high_resolution_clock::now();
+    cpu = loadcputime();
+
+    for (int w = 0; w < LOAD_WAITERS; w++) {
+        hist_init(&hists[w]);
+        threads.emplace_back([&, w]() {
+            epoll_event _event[64];
+            std::vector<char> rbuf(65536);
+            if (sc->affinity)
+                epoll_setworker(w);
+            while (done.load() < writes) {
+                int fds = epoll_wait(epfd, _event, 64, sc->busypoll ? 0 : 100);
+                uint64_t now = loadnow();
+                for (int i = 0; i < fds; i++) {
+                    loadpair* p = (loadpair*)_event[i].data.ptr;
+                    uint64_t t = p->sent.load();
+                    int len;
+                    /*a late duplicate may already see the next message's send time*/
+                    if (t != 0 && t <= now && p->sent.compare_exchange_strong(t, 0))
+                        hist_record(&hists[w], now - t);
+                    events++;
+                    int room = sc->readchunk ? sc->readchunk : (int)rbuf.size();
+                    while ((len = recv(p->s[0], rbuf.data(), room, 0)) > 0) {
+                        if (p->received.fetch_add(len) + len == sc->msgsize) {
+                            p->received = 0;
+                            if (p->waiter.exchange(w) != w)
+                                handoffs++;
+                            if (sc->churn)
+                                epoll_ctl(epfd, EPOLL_CTL_DEL, p->fd, NULL);
+                            p->inflight = 0;
+                            done++;
+                        }
+                        /*the rest is left for the next event*/
+                        if (sc->readchunk)
+                            break;
+                    }
+                }
+            }
+        });
+    }
+
+    for (int w = 0; w < LOAD_WRITERS; w++) {
+        threads.emplace_back([&, w]() {
+            while (issued.load() < writes) {
+                int sent = 0;
+                for (size_t i = w; i < active.size(); i += LOAD_WRITERS) {
+                    loadpair* p = active[i];
+                    if (p->inflight.load() != 0)
+                        continue;
+                    if (issued.fetch_add(1) >= writes)
+                        return;
+                    p->inflight = 1;
+                    if (sc->churn)
+                        loadadd(p);
+                    p->sent = loadnow();
+                    for (size_t off = 0; off < sc->msgsize;) {
+                        int len = send(p->s[1], msg.data() + off, (int)(sc->msgsize - off), 0);
+                        if (len <= 0) {
+                            errors++;
+                            break;
+                        }
+                        off += len;
+                    }
+                    sent++;
+                }
+                if (sent == 0)
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+    endtick = std::chrono::high_resolution_clock::now();
+    cpu = loadcputime() - cpu;
+
+    hist_init(&all);
+    for (int w = 0; w < LOAD_WAITERS; w++)
+        hist_merge(&all, &hists[w]);
+
+    auto dur = std::chrono::duration_cast<std::chrono::microseconds>(endtick - startick).count();
+    double secs = dur > 0 ? dur / 1e6 : 1e-6;
+    printf("Scenario:%s Pairs:%zu Active:%zu Messages:%zu Events:%zu Events/sec:%.0f Messages/sec:%.0f Error:%d\n",
+        sc->name, con, active.size(), done.load(), events.load(), events.load() / secs, done.load() / secs, errors.load());
+    printf("Wakeup latency usec p50:%.1f p99:%.1f p99.9:%.1f max:%.1f Result:%lld usec.\n",
+        hist_percentile(&all, 50) / 1e3, hist_percentile(&all, 99) / 1e3, hist_percentile(&all, 99.9) / 1e3,
+        all.max / 1e3, (long long)dur);
+    /*100% is one core busy for the whole run*/
+    printf("CPU:%.0f%% CPU usec/message:%.2f\n", cpu / (secs * 1e4), done.load() ? (double)cpu / done.load() : 0.0);
+    /*the first message of each pair counts as one*/
+    printf("Handoffs:%zu (%.1f%% of messages)\n", handoffs.load(), done.load() ? handoffs.load() * 100.0 / done.load() : 0.0);
+    struct epoll_stats st;
+    if (done.load() && epoll_stats(epfd, &st) == 0)
+        printf("Polls/message:%.2f Probes/message:%.2f\n", (double)st.polls / done.load(), (double)st.probes / done.load());
+
+    for (n = 0; n < con; n++) {
+        if (!sc->churn)
+            epoll_ctl(epfd, EPOLL_CTL_DEL, pairs[n].fd, NULL);
+        epoll_freefd(pairs[n].fd);
+        closesocket(pairs[n].s[0]);
+        closesocket(pairs[n].s[1]);
+    }
+    epoll_close(epfd);
+}
 
 void readcb(SOCKET s)
 {
@@ -238,7 +790,7 @@ void readcb(SOCKET s)
 
     ncount++;
 
-    if (ncount >= con) {
+    if ((size_t)ncount >= con) {
         ncount = 0;
     }
 
@@ -0,0 +1,197 @@
+/*@file bench_ctl.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * epoll_ctl ADD, MOD and DEL throughput. "sim" registers simulated sockets
+ * (epoll_sim.h) so only the engine is measured, "native" registers real
+ * socket pairs and includes the poll the backend issues for each change.
+ * A round adds every socket, modifies it twice and deletes it. "churn"
+ * deletes the sockets with their polls outstanding, as closing
+ * connections do, and checks that every record comes back.
+ */
+#include "benchreport.h"
+#include "third_party/socketpair.h"
+#include "../epoll_sim.h"
+
+#define NATIVE_PAIRS 256
+
+typedef struct _ctltimes {
+    uint64_t add, mod, del, ops;
+} ctltimes, *pctltimes;
+
+static int ctlround(int epfd, std::vector<int>& fds, pctltimes t) {
+    epoll_event ev = {};
+    uint64_t start;
+    size_t n;
+
+    start = bench_now();
+    for (n = 0; n < fds.size(); n++) {
+        ev.events = EPOLLIN;
+        ev.data.fd = fds[n];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[n], &ev) < 0)
+            return -1;
+    }
+    t->add += bench_now() - start;
+
+    start = bench_now();
+    for (n = 0; n < fds.size(); n++) {
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.fd = fds[n];
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fds[n], &ev);
+        ev.events = EPOLLIN;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fds[n], &ev);
+    }
+    t->mod += bench_now() - start;
+
+    start = bench_now();
+    for (n = 0; n < fds.size(); n++)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fds[n], NULL);
+    t->del += bench_now() - start;
+
+    t->ops += fds.size();
+    return 0;
+}
+
+/*runs rounds over fds until iterations registrations were made*/
+static int ctlbench(pbench_run run, const char* prefix, std::vector<int>& fds) {
+    std::string name;
+    ctltimes t = {};
+    int epfd = epoll_create1(0);
+
+    if (epfd < 0)
+        return -1;
+    while (t.ops < run->iterations) {
+        if (ctlround(epfd, fds, &t) < 0) {
+            fprintf(stderr, "ctl: %s EPOLL_CTL_ADD failed, errno %d\n", prefix, errno);
+            epoll_close(epfd);
+            return -1;
+        }
+    }
+    epoll_close(epfd);
+
+    name = std::string(prefix) + "/add";
+    bench_add(run, name.c_str(), t.ops, t.add);
+    name = std::string(prefix) + "/mod";
+    bench_add(run, name.c_str(), t.ops * 2, t.mod);
+    name = std::string(prefix) + "/del";
+    bench_add(run, name.c_str(), t.ops, t.del);
+    return 0;
+}
+
+/*
+ * every round adds the sockets, lets a wait issue their polls and deletes
+ * them, ops are ADD + DEL pairs. Fails when records are still held once
+ * the cancels have completed.
+ */
+static int churnbench(pbench_run run, const char* prefix, std::vector<int>& fds) {
+    epoll_event events[64];
+    epoll_event ev = {};
+    struct epoll_slabinfo si = {};
+    std::string name;
+    uint64_t ops = 0, ns = 0, start;
+    int epfd = epoll_create1(0);
+    size_t n;
+    int tries;
+
+    if (epfd < 0)
+        return -1;
+    while (ops < run->iterations) {
+        start = bench_now();
+        for (n = 0; n < fds.size(); n++) {
+            ev.events = EPOLLIN;
+            ev.data.fd = fds[n];
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[n], &ev) < 0) {
+                fprintf(stderr, "ctl: %s churn EPOLL_CTL_ADD failed, errno %d\n", prefix, errno);
+                epoll_close(epfd);
+                return -1;
+            }
+        }
+        epoll_wait(epfd, events, 64, 0);
+        for (n = 0; n < fds.size(); n++)
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fds[n], NULL);
+        ns += bench_now() - start;
+        ops += fds.size();
+    }
+
+    /*the last DELs are cancelled by the next wait, their completions follow*/
+    for (tries = 0; tries < 1000; tries++) {
+        epoll_wait(epfd, events, 64, 1);
+        if (epoll_slabinfo(epfd, &si) == 0 && si.inuse == 0 && si.detached == 0)
+            break;
+    }
+    epoll_close(epfd);
+    if (si.inuse != 0 || si.detached != 0) {
+        fprintf(stderr, "ctl: %s churn left %u records (%u detached)\n", prefix, si.inuse, si.detached);
+        return -1;
+    }
+
+    name = std::string(prefix) + "/churn";
+    bench_add(run, name.c_str(), ops, ns);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    bench_run run;
+    std::vector<socket_t> sims;
+    std::vector<SOCKET> pairs;
+    std::vector<int> fds;
+    SOCKET s[2];
+    size_t n;
+    int ret = 0;
+
+    if (bench_init(&run, "ctl", 100000, argc, argv) < 0)
+        return 1;
+
+    epoll_setbackend(&epoll_backend_sim);
+    for (n = 0; n < 4096; n++) {
+        sims.push_back(epoll_sim_socket());
+        fds.push_back(epoll_sock2fd(sims.back()));
+    }
+    if (ctlbench(&run, "sim", fds) < 0 || churnbench(&run, "sim", fds) < 0)
+        ret = 1;
+    for (n = 0; n < sims.size(); n++) {
+        epoll_freefd(fds[n]);
+        epoll_sim_close(sims[n]);
+    }
+    epoll_setbackend(NULL);
+
+    fds.clear();
+    for (n = 0; n < NATIVE_PAIRS; n++) {
+        if (dumb_socketpair(s, 0) != 0)
+            break;
+        pairs.push_back(s[0]);
+        pairs.push_back(s[1]);
+        fds.push_back(epoll_sock2fd(s[0]));
+    }
+    if (ctlbench(&run, "native", fds) < 0 || churnbench(&run, "native", fds) < 0)
+        ret = 1;
+    for (n = 0; n < fds.size(); n++)
+        epoll_freefd(fds[n]);
+    for (n = 0; n < pairs.size(); n++)
+        closesocket(pairs[n]);
+
+    if (bench_finish(&run) < 0)
+        ret = 1;
+    return ret;
+}
@@ -0,0 +1,78 @@
+/*@file bench_fdtable.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * fd table operations: insert, wait-free lookup, reverse find and free of
+ * a set of handles, then the same set reinserted into the recycled slots.
+ */
+#include "benchreport.h"
+#include "../fdtable.h"
+
+static fd_table table;
+
+int main(int argc, char* argv[]) {
+    bench_run run;
+    std::vector<int> fds;
+    uint64_t n, count, start, handle, sum = 0;
+
+    if (bench_init(&run, "fdtable", 100000, argc, argv) < 0)
+        return 1;
+    count = run.iterations < FDTABLE_MAX_INDEX ? run.iterations : FDTABLE_MAX_INDEX - 1;
+    fds.resize(count);
+
+    start = bench_now();
+    for (n = 0; n < count; n++)
+        fds[n] = fdtable_insert(&table, 0x1000 + n * 4, NULL);
+    bench_add(&run, "insert", count, bench_now() - start);
+
+    start = bench_now();
+    for (n = 0; n < count; n++) {
+        /*stride through the table so lookups don't just walk one chunk*/
+        fdtable_lookup(&table, fds[(n * 7919) % count], &handle, NULL);
+        sum += handle;
+    }
+    bench_add(&run, "lookup", count, bench_now() - start);
+
+    start = bench_now();
+    for (n = 0; n < count; n++)
+        sum += fdtable_find(&table, 0x1000 + ((n * 7919) % count) * 4);
+    bench_add(&run, "find", count, bench_now() - start);
+
+    start = bench_now();
+    for (n = 0; n < count; n++)
+        fdtable_free(&table, fds[n]);
+    bench_add(&run, "free", count, bench_now() - start);
+
+    start = bench_now();
+    for (n = 0; n < count; n++)
+        fds[n] = fdtable_insert(&table, 0x1000 + n * 4, NULL);
+    bench_add(&run, "reinsert", count, bench_now() - start);
+
+    /*keeps the lookups from being optimized away*/
+    if (sum == 0)
+        fprintf(stderr, "fdtable: empty table\n");
+
+    fdtable_destroy(&table);
+    return bench_finish(&run) < 0 ? 1 : 0;
+}
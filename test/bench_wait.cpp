@@ -0,0 +1,132 @@
+/*@file bench_wait.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * epoll_wait latency on one socket pair. "ready" writes a byte and waits
+ * on the same thread, so the event is there before the call. "wakeup"
+ * writes from another thread while the waiter is (usually) blocked and
+ * measures from the send to the return of epoll_wait.
+ */
+#include "benchreport.h"
+#include "third_party/socketpair.h"
+#include "../epoll.h"
+
+#include <atomic>
+#include <thread>
+
+static int epfd;
+static SOCKET s[2];
+
+static int waitone() {
+    epoll_event ev;
+    char c;
+    int n;
+
+    do {
+        n = epoll_wait(epfd, &ev, 1, -1);
+    } while (n == 0);
+    if (n < 0)
+        return -1;
+    recv(s[0], &c, 1, 0);
+    return 0;
+}
+
+static void readybench(pbench_run run) {
+    static histogram h;
+    uint64_t start, t0;
+    uint64_t n;
+
+    hist_init(&h);
+    start = bench_now();
+    for (n = 0; n < run->iterations; n++) {
+        t0 = bench_now();
+        send(s[1], "x", 1, 0);
+        if (waitone() < 0)
+            break;
+        hist_record(&h, bench_now() - t0);
+    }
+    bench_addhist(run, "ready", &h, bench_now() - start);
+}
+
+static void wakeupbench(pbench_run run) {
+    static histogram h;
+    std::atomic<uint64_t> sent(0);
+    std::atomic<uint64_t> done(0);
+    uint64_t start;
+    uint64_t n;
+
+    hist_init(&h);
+    std::thread waiter([&] {
+        for (uint64_t i = 0; i < run->iterations; i++) {
+            if (waitone() < 0)
+                break;
+            hist_record(&h, bench_now() - sent.load());
+            done.store(i + 1);
+        }
+        done.store(run->iterations);
+    });
+
+    start = bench_now();
+    for (n = 0; n < run->iterations; n++) {
+        sent.store(bench_now());
+        send(s[1], "x", 1, 0);
+        while (done.load() <= n)
+            std::this_thread::yield();
+    }
+    waiter.join();
+    bench_addhist(run, "wakeup", &h, bench_now() - start);
+}
+
+int main(int argc, char* argv[]) {
+    bench_run run;
+    epoll_event ev = {};
+    int fd;
+
+    if (bench_init(&run, "wait", 20000, argc, argv) < 0)
+        return 1;
+
+    if (dumb_socketpair(s, 0) != 0) {
+        fprintf(stderr, "wait: socketpair failed, err %d\n", WSAGetLastError());
+        return 1;
+    }
+    setnonblocking(s[0]);
+    epfd = epoll_create1(0);
+    fd = epoll_sock2fd(s[0]);
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        fprintf(stderr, "wait: epoll setup failed, errno %d\n", errno);
+        return 1;
+    }
+
+    readybench(&run);
+    wakeupbench(&run);
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    epoll_close(epfd);
+    epoll_freefd(fd);
+    closesocket(s[0]);
+    closesocket(s[1]);
+    return bench_finish(&run) < 0 ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+/*@file benchreport.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+/*
+ * shared harness of the micro-benchmarks: argument parsing and a result
+ * table printed as JSON (default) or CSV, so runs can be stored and
+ * compared across commits.
+ *
+ * usage: bench_xxx [iterations] [--csv] [--out file]
+ */
+#include "portable.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+typedef struct _bench_result {
+    std::string name;
+    uint64_t ops;
+    double seconds;
+    /*latency percentiles in ns, 0 when the case only measures throughput*/
+    double p50;
+    double p99;
+    double p999;
+    double max;
+} bench_result, *pbench_result;
+
+typedef struct _bench_run {
+    const char* bench;
+    uint64_t iterations;
+    int csv;
+    const char* out;
+    std::vector<bench_result> results;
+} bench_run, *pbench_run;
+
+static inline uint64_t bench_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline int bench_init(pbench_run run, const char* bench, uint64_t iterations, int argc, char* argv[]) {
+    run->bench = bench;
+    run->iterations = iterations;
+    run->csv = 0;
+    run->out = NULL;
+
+    for (int n = 1; n < argc; n++) {
+        if (strcmp(argv[n], "--csv") == 0)
+            run->csv = 1;
+        else if (strcmp(argv[n], "--json") == 0)
+            run->csv = 0;
+        else if (strcmp(argv[n], "--out") == 0 && n + 1 < argc)
+            run->out = argv[++n];
+        else if (atoll(argv[n]) > 0)
+            run->iterations = (uint64_t)atoll(argv[n]);
+        else {
+            fprintf(stderr, "usage: %s [iterations] [--csv|--json] [--out file]\n", bench);
+            return -1;
+        }
+    }
+
+#ifdef _WIN32
+    WSADATA WSAData;
+    WSAStartup(0x0202, &WSAData);
+#endif
+    return 0;
+}
+
+static inline void bench_add(pbench_run run, const char* name, uint64_t ops, uint64_t ns) {
+    bench_result r;
+    r.name = name;
+    r.ops = ops;
+    r.seconds = ns / 1e9;
+    r.p50 = r.p99 = r.p999 = r.max = 0;
+    run->results.push_back(r);
+}
+
+/*throughput plus the latency percentiles of h*/
+static inline void bench_addhist(pbench_run run, const char* name, const histogram* h, uint64_t ns) {
+    bench_add(run, name, h->total, ns);
+    pbench_result r = &run->results.back();
+    r->p50 = (double)hist_percentile(h, 50);
+    r->p99 = (double)hist_percentile(h, 99);
+    r->p999 = (double)hist_percentile(h, 99.9);
+    r->max = (double)h->max;
+}
+
+static inline int bench_finish(pbench_run run) {
+    FILE* f = stdout;
+
+    if (run->out != NULL && (f = fopen(run->out, "w")) == NULL) {
+        fprintf(stderr, "%s: can't open %s\n", run->bench, run->out);
+        return -1;
+    }
+
+    if (run->csv)
+        fprintf(f, "bench,case,ops,seconds,ns_per_op,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+    else
+        fprintf(f, "{\"bench\":\"%s\",\"iterations\":%llu,\"results\":[\n", run->bench,
+            (unsigned long long)run->iterations);
+
+    for (size_t n = 0; n < run->results.size(); n++) {
+        pbench_result r = &run->results[n];
+        double nsop = r->ops ? r->seconds * 1e9 / r->ops : 0;
+        double opsec = r->seconds > 0 ? r->ops / r->seconds : 0;
+
+        if (run->csv) {
+            fprintf(f, "%s,%s,%llu,%.6f,%.1f,%.0f,%.0f,%.0f,%.0f,%.0f\n", run->bench, r->name.c_str(),
+                (unsigned long long)r->ops, r->seconds, nsop, opsec, r->p50, r->p99, r->p999, r->max);
+            continue;
+        }
+        fprintf(f, "  {\"case\":\"%s\",\"ops\":%llu,\"seconds\":%.6f,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f",
+            r->name.c_str(), (unsigned long long)r->ops, r->seconds, nsop, opsec);
+        if (r->max > 0)
+            fprintf(f, ",\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f",
+                r->p50, r->p99, r->p999, r->max);
+        fprintf(f, "}%s\n", n + 1 < run->results.size() ? "," : "");
+    }
+
+    if (!run->csv)
+        fprintf(f, "]}\n");
+    if (f != stdout)
+        fclose(f);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return 0;
+}
@@ -0,0 +1,459 @@
+/*@file et_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Deterministic checks of the edge triggered rearm policy (epoll_et.h)
+ * and of EPOLL_LAZY level triggered rearming, run through the real engine
+ * on the simulated backend.
+ *
+ * Simulated sockets keep the AFD semantics the engine relies on: a poll is
+ * one-shot, completes at once when armed on a socket that is already
+ * ready, otherwise when readiness appears. ET ownership is per thread, so
+ * each waiter is a thread that runs one epoll_wait at a time on request
+ * and the interleaving stays fixed. The last checks run ET readers and
+ * writers over a socket pair on the platform backend.
+ */
+#include "../epoll_sim.h"
+#include "../epoll_et.h"
+#include "third_party/socketpair.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define IN  AFD_POLL_RECEIVE
+#define HUP AFD_POLL_DISCONNECT
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAILED %s:%d %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+struct waiter {
+    std::thread t;
+    std::mutex m;
+    std::condition_variable cv;
+    std::function<void()> job;
+    bool quit = false;
+
+    waiter() {
+        t = std::thread([this] {
+            std::unique_lock<std::mutex> l(m);
+            for (;;) {
+                cv.wait(l, [this] { return job || quit; });
+                if (!job)
+                    return;
+                job();
+                job = nullptr;
+                cv.notify_all();
+            }
+        });
+    }
+
+    ~waiter() {
+        {
+            std::lock_guard<std::mutex> l(m);
+            quit = true;
+        }
+        cv.notify_all();
+        t.join();
+    }
+
+    /*one epoll_wait on this waiter's thread, non-blocking by default*/
+    std::vector<epoll_event> wait(int epfd, int timeout = 0) {
+        std::vector<epoll_event> out(16);
+        int n = 0;
+        std::unique_lock<std::mutex> l(m);
+        job = [&] { n = epoll_wait(epfd, out.data(), (int)out.size(), timeout); };
+        cv.notify_all();
+        cv.wait(l, [this] { return !job; });
+        out.resize(n > 0 ? n : 0);
+        return out;
+    }
+};
+
+/*one simulated socket registered on a fresh instance*/
+struct simpoll {
+    int epfd;
+    socket_t s;
+    int fd;
+    uint64_t polls;
+
+    simpoll(uint32_t events, int flags = 0) {
+        epoll_event ev = {};
+        epoll_setbackend(&epoll_backend_sim);
+        epfd = flags != 0 ? epoll_create1(flags) : epoll_create(4);
+        s = epoll_sim_socket();
+        fd = epoll_sock2fd(s);
+        ev.events = events;
+        ev.data.fd = fd;
+        polls = epoll_sim_polls();
+        CHECK(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+    }
+
+    ~simpoll() {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+        epoll_freefd(fd);
+        epoll_sim_close(s);
+        epoll_close(epfd);
+    }
+
+    /*polls issued for this socket so far*/
+    uint64_t ioctls() {
+        return epoll_sim_polls() - polls;
+    }
+};
+
+static waiter A, B;
+
+static void test_level_duplicates() {
+    simpoll p(IN);
+
+    printf("level triggered hands unread data to every waiter\n");
+    A.wait(p.epfd);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    CHECK(B.wait(p.epfd).size() == 1);
+}
+
+static void test_edge_once() {
+    simpoll p(IN | EPOLLET);
+
+    printf("edge triggered reports a transition once\n");
+    A.wait(p.epfd);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    /*A is still reading, another waiter must not see it*/
+    CHECK(B.wait(p.epfd).empty());
+    CHECK(B.wait(p.epfd).empty());
+    epoll_sim_drain(p.s, IN);
+    CHECK(A.wait(p.epfd).empty());
+    epoll_sim_ready(p.s, IN);
+    CHECK(B.wait(p.epfd).size() == 1);
+}
+
+static void test_edge_no_lost_wakeup() {
+    simpoll p(IN | EPOLLET);
+
+    printf("edge triggered keeps data that arrives after the drain\n");
+    A.wait(p.epfd);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    epoll_sim_drain(p.s, IN);
+    epoll_sim_ready(p.s, IN);
+    std::vector<epoll_event> ev = A.wait(p.epfd);
+    CHECK(ev.size() == 1 && ev[0].events == IN);
+}
+
+static void test_edge_new_state() {
+    simpoll p(IN | HUP | EPOLLET);
+
+    printf("edge triggered reports a new state once the reader is back\n");
+    A.wait(p.epfd);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    epoll_sim_drain(p.s, IN);
+    epoll_sim_ready(p.s, HUP);
+    std::vector<epoll_event> ev = A.wait(p.epfd);
+    CHECK(ev.size() == 1 && ev[0].events == HUP);
+}
+
+static void test_edge_owner_gone() {
+    simpoll p(IN | EPOLLET);
+    int n;
+
+    printf("edge triggered record is released when its reader never returns\n");
+    A.wait(p.epfd);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    for (n = 0; n < EPOLL_ET_DEFER_WAITS; n++)
+        CHECK(B.wait(p.epfd).empty());
+    CHECK(B.wait(p.epfd).size() == 1);
+}
+
+static void test_edge_fewer_ioctls() {
+    uint64_t lt, et;
+    int n;
+
+    printf("edge triggered issues no polls while the reader is busy\n");
+    {
+        simpoll p(IN);
+        A.wait(p.epfd);
+        epoll_sim_ready(p.s, IN);
+        A.wait(p.epfd);
+        for (n = 0; n < 8; n++)
+            B.wait(p.epfd);
+        lt = p.ioctls();
+    }
+    {
+        simpoll p(IN | EPOLLET);
+        A.wait(p.epfd);
+        epoll_sim_ready(p.s, IN);
+        A.wait(p.epfd);
+        for (n = 0; n < 8; n++)
+            B.wait(p.epfd);
+        et = p.ioctls();
+    }
+    CHECK(et == 1);
+    CHECK(lt == 9);
+}
+
+static void test_oneshot() {
+    simpoll p(IN | EPOLLONESHOT);
+    epoll_event ev = {};
+
+    printf("oneshot reports once until it is modified\n");
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    CHECK(B.wait(p.epfd).empty());
+    ev.events = IN | EPOLLONESHOT;
+    ev.data.fd = p.fd;
+    CHECK(epoll_ctl(p.epfd, EPOLL_CTL_MOD, p.fd, &ev) == 0);
+    /*the disarmed poll is cancelled first, give the rearm a round trip*/
+    CHECK(B.wait(p.epfd, 1000).size() == 1);
+}
+
+static void test_stats() {
+    simpoll p(IN);
+    epoll_event ev = {};
+    struct epoll_stats st;
+
+    printf("epoll_stats counts polls, cancels and filtered completions\n");
+    A.wait(p.epfd);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    epoll_sim_drain(p.s, IN);
+    CHECK(A.wait(p.epfd).empty());
+    /*wanting more than the outstanding poll cancels and redoes it*/
+    ev.events = IN | HUP;
+    ev.data.fd = p.fd;
+    CHECK(epoll_ctl(p.epfd, EPOLL_CTL_MOD, p.fd, &ev) == 0);
+    CHECK(A.wait(p.epfd, 50).empty());
+    /*built with EPOLL_NO_STATS*/
+    if (epoll_stats(p.epfd, &st) < 0) {
+        CHECK(errno == ENOSYS);
+        return;
+    }
+    CHECK(st.waits == 4);
+    CHECK(st.events == 1);
+    CHECK(st.polls == 3);
+    CHECK(st.cancels == 1);
+    CHECK(st.completions == 2);
+    CHECK(st.filtered == 1);
+    CHECK(st.outstanding == 1);
+    CHECK(st.batch_hist[0] == 3 && st.batch_hist[1] == 1);
+}
+
+static void test_lazy_fewer_ioctls() {
+    simpoll p(IN, EPOLL_LAZY);
+    struct epoll_stats st;
+    int n;
+
+    printf("lazy level triggered probes instead of polling while data is unread\n");
+    A.wait(p.epfd);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    /*still reported to every waiter, level triggered as before*/
+    for (n = 0; n < 8; n++)
+        CHECK(B.wait(p.epfd).size() == 1);
+    CHECK(p.ioctls() == 1);
+    /*drained, the probe misses and the poll is back*/
+    epoll_sim_drain(p.s, IN);
+    CHECK(A.wait(p.epfd).empty());
+    CHECK(p.ioctls() == 2);
+    CHECK(A.wait(p.epfd).empty());
+    CHECK(p.ioctls() == 2);
+    epoll_sim_ready(p.s, IN);
+    CHECK(B.wait(p.epfd).size() == 1);
+    if (epoll_stats(p.epfd, &st) == 0)
+        CHECK(st.probes == 9 && st.probehits == 8);
+}
+
+static void test_lazy_drained() {
+    simpoll p(IN, EPOLL_LAZY);
+    epoll_event ev = {};
+    struct epoll_stats st;
+
+    printf("epoll_drained polls a lazy record without probing it\n");
+    CHECK(epoll_drained(p.epfd, p.fd + 4) < 0 && errno == ENOENT);
+    A.wait(p.epfd);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    epoll_sim_drain(p.s, IN);
+    CHECK(epoll_drained(p.epfd, p.fd) == 0);
+    CHECK(A.wait(p.epfd).empty());
+    CHECK(p.ioctls() == 2);
+    if (epoll_stats(p.epfd, &st) == 0)
+        CHECK(st.probes == 0);
+
+    printf("a lazy record can be modified and deleted while it is parked\n");
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+    ev.events = IN | HUP;
+    ev.data.fd = p.fd;
+    CHECK(epoll_ctl(p.epfd, EPOLL_CTL_MOD, p.fd, &ev) == 0);
+    CHECK(A.wait(p.epfd).size() == 1);
+    CHECK(epoll_ctl(p.epfd, EPOLL_CTL_DEL, p.fd, NULL) == 0);
+    CHECK(A.wait(p.epfd).empty());
+}
+
+static void test_deferred_cancel() {
+    simpoll p(IN);
+    epoll_event ev = {};
+    struct epoll_slabinfo si;
+    struct epoll_stats st;
+
+    printf("DEL cancels on the next pass and frees the record once it completes\n");
+    A.wait(p.epfd);
+    CHECK(epoll_ctl(p.epfd, EPOLL_CTL_DEL, p.fd, NULL) == 0);
+    CHECK(epoll_slabinfo(p.epfd, &si) == 0 && si.detached == 1 && si.inuse == 1);
+    if (epoll_stats(p.epfd, &st) == 0)
+        CHECK(st.cancels == 0);
+    /*added back before the pass, the old poll is still cancelled*/
+    ev.events = IN;
+    ev.data.fd = p.fd;
+    CHECK(epoll_ctl(p.epfd, EPOLL_CTL_ADD, p.fd, &ev) == 0);
+    if (epoll_stats(p.epfd, &st) == 0)
+        CHECK(st.cancels == 1);
+    CHECK(A.wait(p.epfd).empty());
+    CHECK(epoll_slabinfo(p.epfd, &si) == 0 && si.detached == 0 && si.inuse == 1);
+    epoll_sim_ready(p.s, IN);
+    CHECK(A.wait(p.epfd).size() == 1);
+
+    printf("a DEL whose poll completed first needs no cancel\n");
+    epoll_sim_drain(p.s, IN);
+    A.wait(p.epfd);
+    /*B is blocked meanwhile and dequeues the completion, nothing is reported*/
+    size_t got = 1;
+    std::thread t([&] { got = B.wait(p.epfd, 100).size(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(epoll_ctl(p.epfd, EPOLL_CTL_DEL, p.fd, NULL) == 0);
+    epoll_sim_ready(p.s, IN);
+    t.join();
+    CHECK(got == 0);
+    CHECK(epoll_slabinfo(p.epfd, &si) == 0 && si.detached == 0 && si.inuse == 0);
+    if (epoll_stats(p.epfd, &st) == 0)
+        CHECK(st.cancels == 1);
+}
+
+/*a socket pair on the platform backend, s[0] non-blocking and registered*/
+struct sockpoll {
+    int epfd;
+    SOCKET s[2];
+    int fd;
+
+    sockpoll(uint32_t events) {
+        epoll_event ev = {};
+        epoll_setbackend(NULL);
+        epfd = epoll_create(4);
+        CHECK(dumb_socketpair(s, 1) == 0);
+        setnonblocking(s[0]);
+        setnonblocking(s[1]);
+        fd = epoll_sock2fd(s[0]);
+        ev.events = events;
+        ev.data.fd = fd;
+        CHECK(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+    }
+
+    ~sockpoll() {
+        epoll_close(epfd);
+        epoll_freefd(fd);
+        closesocket(s[0]);
+        closesocket(s[1]);
+        epoll_setbackend(&epoll_backend_sim);
+    }
+
+    /*reads or discards what sock holds up to EAGAIN*/
+    static void drain(SOCKET sock) {
+        char buf[4096];
+        while (recv(sock, buf, sizeof(buf), 0) > 0)
+            ;
+    }
+};
+
+static void test_edge_reader_rounds() {
+    sockpoll p(EPOLLIN | EPOLLET);
+    epoll_event ev[4];
+    int round;
+
+    printf("edge triggered reader sees every same sized message it drains\n");
+    for (round = 0; round < 4; round++) {
+        CHECK(send(p.s[1], "x", 1, 0) == 1);
+        CHECK(epoll_wait(p.epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLIN));
+        sockpoll::drain(p.s[0]);
+    }
+}
+
+static void test_edge_writer_rounds() {
+    sockpoll p(EPOLLOUT | EPOLLET);
+    epoll_event ev[4];
+    char buf[4096] = {};
+    int round;
+
+    printf("edge triggered writer is told when a full socket drains\n");
+    CHECK(epoll_wait(p.epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLOUT));
+    for (round = 0; round < 3; round++) {
+        while (send(p.s[0], buf, sizeof(buf), 0) > 0)
+            ;
+        sockpoll::drain(p.s[1]);
+        CHECK(epoll_wait(p.epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLOUT));
+    }
+}
+
+int main() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    test_level_duplicates();
+    test_edge_once();
+    test_edge_no_lost_wakeup();
+    test_edge_new_state();
+    test_edge_owner_gone();
+    test_edge_fewer_ioctls();
+    test_oneshot();
+    test_stats();
+    test_lazy_fewer_ioctls();
+    test_lazy_drained();
+    test_deferred_cancel();
+    test_edge_reader_rounds();
+    test_edge_writer_rounds();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,240 @@
+/*@file eventfd_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * epoll_eventfd through the engine on the simulated backend: readiness,
+ * coalescing of signals into one posted completion, wakeups from another
+ * thread, close while registered, and epoll_postqueued not latching the
+ * instance closed. Busy polling is checked here as well, eventfd signals
+ * being the easiest completions to time.
+ */
+#include "../epoll_sim.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <chrono>
+#include <thread>
+
+#define SIGNALS 1000000
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAILED %s:%d %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static int addevfd(int epfd, int efd, uint32_t events) {
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = efd;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev);
+}
+
+static void test_readiness() {
+    epoll_event ev[4];
+    uint64_t value = 0;
+    int epfd, efd;
+
+    printf("eventfd is readable while its counter is non-zero\n");
+    epfd = epoll_create(4);
+    efd = epoll_eventfd(0);
+    CHECK(efd > 0);
+    CHECK(addevfd(epfd, efd, EPOLLIN) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 0) == 0);
+    CHECK(epoll_eventfd_write(efd, 3) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && ev[0].events == EPOLLIN && ev[0].data.fd == efd);
+    /*level triggered, still readable*/
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1);
+    CHECK(epoll_eventfd_read(efd, &value) == 0 && value == 3);
+    CHECK(epoll_eventfd_read(efd, &value) < 0 && errno == EAGAIN);
+    CHECK(epoll_wait(epfd, ev, 4, 30) == 0);
+    CHECK(epoll_ctl(epfd, EPOLL_CTL_DEL, efd, NULL) == 0);
+    CHECK(epoll_eventfd_close(efd) == 0);
+    CHECK(epoll_eventfd_write(efd, 1) < 0 && errno == EBADF);
+    epoll_close(epfd);
+}
+
+static void test_coalescing() {
+    epoll_event ev[4];
+    uint64_t value = 0, posts;
+    int epfd, efd, n;
+
+    printf("%d signals post a single completion\n", SIGNALS);
+    epfd = epoll_create(4);
+    efd = epoll_eventfd(0);
+    CHECK(addevfd(epfd, efd, EPOLLIN | EPOLLET) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 0) == 0);
+    posts = epoll_sim_posts();
+    for (n = 0; n < SIGNALS; n++)
+        epoll_eventfd_write(efd, 1);
+    CHECK(epoll_sim_posts() - posts == 1);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1);
+    CHECK(epoll_eventfd_read(efd, &value) == 0 && value == SIGNALS);
+    CHECK(epoll_wait(epfd, ev, 4, 0) == 0);
+    /*the reader is back, the next signal is reported again*/
+    CHECK(epoll_eventfd_write(efd, 1) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1);
+    epoll_eventfd_close(efd);
+    epoll_close(epfd);
+}
+
+static void test_cross_thread() {
+    epoll_event ev[4];
+    uint64_t value, total = 0;
+    int epfd, efd, n;
+
+    printf("a producer thread's signals are all counted\n");
+    epfd = epoll_create(4);
+    efd = epoll_eventfd(0);
+    CHECK(addevfd(epfd, efd, EPOLLIN) == 0);
+    std::thread producer([efd] {
+        for (int i = 0; i < 100000; i++)
+            epoll_eventfd_write(efd, 1);
+    });
+    while (total < 100000) {
+        n = epoll_wait(epfd, ev, 4, 2000);
+        if (n <= 0)
+            break;
+        if (epoll_eventfd_read(efd, &value) == 0)
+            total += value;
+    }
+    producer.join();
+    CHECK(total == 100000);
+    epoll_eventfd_close(efd);
+    epoll_close(epfd);
+}
+
+static void test_close_registered() {
+    epoll_event ev[4];
+    int epfd, efd;
+
+    printf("closing a registered eventfd hangs its registration up\n");
+    epfd = epoll_create(4);
+    efd = epoll_eventfd(0);
+    CHECK(addevfd(epfd, efd, EPOLLIN | EPOLLHUP) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 0) == 0);
+    CHECK(epoll_eventfd_close(efd) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLHUP));
+    CHECK(epoll_ctl(epfd, EPOLL_CTL_DEL, efd, NULL) == 0);
+    epoll_close(epfd);
+}
+
+static void test_postqueued() {
+    epoll_event ev[4];
+    int epfd, efd, n = -1;
+    long long took = 0;
+
+    printf("epoll_postqueued wakes one wait and leaves the instance usable\n");
+    epfd = epoll_create(4);
+    std::thread t([&] {
+        auto start = std::chrono::steady_clock::now();
+        n = epoll_wait(epfd, ev, 4, 5000);
+        took = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    epoll_postqueued(epfd);
+    t.join();
+    CHECK(n == 0 && took < 2000);
+    efd = epoll_eventfd(1);
+    CHECK(addevfd(epfd, efd, EPOLLIN) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1);
+    epoll_eventfd_close(efd);
+    epoll_close(epfd);
+}
+
+static void test_busypoll() {
+    epoll_event ev[4];
+    epoll_busypoll bp = {};
+    struct epoll_stats st = {};
+    uint64_t value = 0;
+    int epfd, efd, n;
+
+    printf("busy polling picks up a signal without blocking\n");
+    epfd = epoll_create(4);
+    efd = epoll_eventfd(0);
+    CHECK(addevfd(epfd, efd, EPOLLIN | EPOLLET) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 0) == 0);
+    bp.usecs = 500000;
+    CHECK(epoll_setbusypoll(epfd, &bp) == 0);
+    bp = {};
+    CHECK(epoll_getbusypoll(epfd, &bp) == 0 && bp.usecs == 500000 && !bp.adaptive && bp.current == 500000);
+    std::thread producer([efd] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        epoll_eventfd_write(efd, 1);
+    });
+    n = epoll_wait(epfd, ev, 4, 2000);
+    producer.join();
+    CHECK(n == 1);
+    CHECK(epoll_eventfd_read(efd, &value) == 0 && value == 1);
+    if (epoll_stats(epfd, &st) == 0)
+        CHECK(st.spins == 1 && st.spinhits == 1);
+    /*a short timeout cuts the spin*/
+    auto start = std::chrono::steady_clock::now();
+    CHECK(epoll_wait(epfd, ev, 4, 10) == 0);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(400));
+
+    printf("adaptive busy polling backs off when idle and grows on arrivals\n");
+    bp.usecs = 100000;
+    bp.adaptive = 1;
+    CHECK(epoll_setbusypoll(epfd, &bp) == 0);
+    for (n = 0; n < 20; n++)
+        epoll_wait(epfd, ev, 4, 1);
+    CHECK(epoll_getbusypoll(epfd, &bp) == 0 && bp.usecs == 100000 && bp.adaptive && bp.current == 0);
+    /*an arrival within the budget after the spin gave up*/
+    std::thread late([efd] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        epoll_eventfd_write(efd, 1);
+    });
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1);
+    late.join();
+    CHECK(epoll_getbusypoll(epfd, &bp) == 0 && bp.current == 10);
+    CHECK(epoll_eventfd_read(efd, &value) == 0 && value == 1);
+    bp.usecs = 0;
+    CHECK(epoll_setbusypoll(epfd, &bp) == 0);
+    CHECK(epoll_getbusypoll(epfd, &bp) == 0 && bp.current == 0);
+    epoll_eventfd_close(efd);
+    epoll_close(epfd);
+}
+
+int main() {
+    epoll_setbackend(&epoll_backend_sim);
+
+    test_readiness();
+    test_coalescing();
+    test_cross_thread();
+    test_close_registered();
+    test_postqueued();
+    test_busypoll();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,230 @@
+/*@file fdtable_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * fdtable on its own: generation tagged slot reuse, stale fds failing every
+ * accessor once their slot is freed, deleted entries in the handle hash and
+ * the FDTABLE_MAX_INDEX limit. Tables are zero-initialized statics and are
+ * released with fdtable_destroy.
+ */
+#include "../fdtable.h"
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAILED %s:%d %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static int fdindex(int fd) {
+    return fd & FDTABLE_MAX_INDEX;
+}
+
+static void test_reuse() {
+    static fd_table t;
+    uint64_t handle = 0;
+    void* data = NULL;
+    int a, b, c;
+
+    printf("a freed slot is reused under a new generation\n");
+
+    a = fdtable_insert(&t, 100, &handle);
+    CHECK(a > 0);
+    CHECK(fdtable_insert(&t, 100, NULL) == a);
+    CHECK(fdtable_find(&t, 100) == a);
+    CHECK(fdtable_lookup(&t, a, &handle, &data) == 0 && handle == 100 && data == &handle);
+    CHECK(fdtable_count(&t) == 1);
+
+    CHECK(fdtable_free(&t, a) == 0);
+    CHECK(fdtable_count(&t) == 0);
+    b = fdtable_insert(&t, 200, NULL);
+    CHECK(b > 0 && b != a);
+    CHECK(fdindex(b) == fdindex(a));
+    CHECK(fdtable_lookup(&t, b, &handle, NULL) == 0 && handle == 200);
+
+    /*a third handle takes a fresh slot while b is live*/
+    c = fdtable_inserttype(&t, 300, 7, NULL);
+    CHECK(c > 0 && fdindex(c) != fdindex(b));
+    CHECK(fdtable_type(&t, c) == 7);
+    CHECK(fdtable_type(&t, b) == 0);
+
+    fdtable_destroy(&t);
+}
+
+static void test_stale() {
+    static fd_table t;
+    uint64_t handle = 0;
+    void* data = NULL;
+    int a, b;
+
+    printf("a stale fd fails every accessor after free and reuse\n");
+
+    a = fdtable_inserttype(&t, 100, 3, &data);
+    CHECK(fdtable_free(&t, a) == 0);
+
+    /*freed but not reused*/
+    CHECK(fdtable_lookup(&t, a, &handle, &data) < 0);
+    CHECK(fdtable_type(&t, a) < 0);
+    CHECK(fdtable_free(&t, a) < 0);
+    CHECK(fdtable_sethandle(&t, a, 1) < 0);
+    CHECK(fdtable_setdata(&t, a, &handle) < 0);
+    CHECK(fdtable_find(&t, 100) < 0);
+
+    /*reused by another handle, the old fd must not alias the new owner*/
+    b = fdtable_insert(&t, 200, &handle);
+    CHECK(fdindex(b) == fdindex(a));
+    CHECK(fdtable_lookup(&t, a, NULL, NULL) < 0);
+    CHECK(fdtable_type(&t, a) < 0);
+    CHECK(fdtable_free(&t, a) < 0);
+    CHECK(fdtable_sethandle(&t, a, 1) < 0);
+    CHECK(fdtable_setdata(&t, a, NULL) < 0);
+    CHECK(fdtable_lookup(&t, b, &handle, &data) == 0 && handle == 200 && data == &handle);
+    CHECK(fdtable_count(&t) == 1);
+
+    /*fds never handed out*/
+    CHECK(fdtable_lookup(&t, 0, NULL, NULL) < 0);
+    CHECK(fdtable_lookup(&t, -1, NULL, NULL) < 0);
+    CHECK(fdtable_lookup(&t, fdindex(b) + 1, NULL, NULL) < 0);
+    CHECK(fdtable_lookup(&t, FDTABLE_MAX_INDEX, NULL, NULL) < 0);
+
+    fdtable_destroy(&t);
+}
+
+static void test_generation_wrap() {
+    static fd_table t;
+    int fd, first, prev = 0, i, ok = 1;
+
+    printf("the generation wraps without producing a non-positive fd\n");
+
+    first = fdtable_insert(&t, 1, NULL);
+    CHECK(fdtable_free(&t, first) == 0);
+    for (i = 0; i < (1 << FDTABLE_GEN_BITS) * 2; i++) {
+        fd = fdtable_insert(&t, 1, NULL);
+        if (fd <= 0 || fdindex(fd) != fdindex(first) || fd == prev)
+            ok = 0;
+        if (fdtable_free(&t, fd) < 0 || fdtable_lookup(&t, fd, NULL, NULL) == 0)
+            ok = 0;
+        prev = fd;
+    }
+    CHECK(ok);
+    CHECK(fdtable_count(&t) == 0);
+
+    fdtable_destroy(&t);
+}
+
+#define HASHKEYS 1000
+
+static void test_hash_deleted() {
+    static fd_table t;
+    static int fds[HASHKEYS];
+    int i, fd, ok = 1;
+
+    printf("lookups by handle skip deleted hash entries\n");
+
+    for (i = 0; i < HASHKEYS; i++)
+        fds[i] = fdtable_insert(&t, (uint64_t)i + 1, NULL);
+    for (i = 0; i < HASHKEYS; i += 2)
+        CHECK(fdtable_free(&t, fds[i]) == 0);
+
+    /*probes have to walk past the deleted entries*/
+    for (i = 0; i < HASHKEYS; i++) {
+        fd = fdtable_find(&t, (uint64_t)i + 1);
+        if ((i & 1) ? fd != fds[i] : fd >= 0)
+            ok = 0;
+    }
+    CHECK(ok);
+    CHECK(fdtable_count(&t) == HASHKEYS / 2);
+
+    /*freed handles come back under new fds, live ones keep theirs*/
+    for (i = 0; i < HASHKEYS; i++) {
+        fd = fdtable_insert(&t, (uint64_t)i + 1, NULL);
+        if ((i & 1) ? fd != fds[i] : (fd <= 0 || fd == fds[i]))
+            ok = 0;
+        fds[i] = fd;
+    }
+    CHECK(ok);
+    CHECK(fdtable_count(&t) == HASHKEYS);
+    for (i = 0; i < HASHKEYS; i++)
+        CHECK(fdtable_free(&t, fds[i]) == 0);
+
+    /*churn through distinct handles, deleted entries must not grow the hash*/
+    for (i = 0; i < 100000; i++) {
+        fd = fdtable_insert(&t, (uint64_t)i + 10000, NULL);
+        if (fd <= 0 || fdtable_find(&t, (uint64_t)i + 10000) != fd || fdtable_free(&t, fd) < 0)
+            ok = 0;
+    }
+    CHECK(ok);
+    CHECK(fdtable_count(&t) == 0);
+    CHECK(t.hashcap <= HASHKEYS * 8);
+    CHECK(t.hashused * 2 <= t.hashcap);
+
+    fdtable_destroy(&t);
+}
+
+static void test_max_index() {
+    static fd_table t;
+    uint64_t handle = 0;
+    int fd, fd2;
+
+    printf("inserts fail past FDTABLE_MAX_INDEX until a slot is freed\n");
+
+    /*skip to the last index instead of filling two million slots*/
+    t.nextindex = FDTABLE_MAX_INDEX;
+
+    fd = fdtable_insert(&t, 1, NULL);
+    CHECK(fd == FDTABLE_MAX_INDEX);
+    CHECK(fdtable_lookup(&t, fd, &handle, NULL) == 0 && handle == 1);
+    CHECK(fdtable_insert(&t, 2, NULL) < 0);
+    CHECK(fdtable_find(&t, 2) < 0);
+    CHECK(fdtable_count(&t) == 1);
+
+    /*the only way back in is the free list*/
+    CHECK(fdtable_free(&t, fd) == 0);
+    fd2 = fdtable_insert(&t, 2, NULL);
+    CHECK(fd2 > 0 && fd2 != fd && fdindex(fd2) == FDTABLE_MAX_INDEX);
+    CHECK(fdtable_lookup(&t, fd, NULL, NULL) < 0);
+    CHECK(fdtable_insert(&t, 3, NULL) < 0);
+    CHECK(fdtable_free(&t, fd2) == 0);
+
+    fdtable_destroy(&t);
+}
+
+int main() {
+    test_reuse();
+    test_stale();
+    test_generation_wrap();
+    test_hash_deleted();
+    test_max_index();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
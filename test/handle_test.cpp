@@ -0,0 +1,330 @@
+/*@file handle_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * pipes and regular files through epoll_handle2fd with the platform
+ * backend: a pipe's read end is readable while it holds data and hangs up
+ * with its writer, a write end is writable, a named pipe server reports
+ * its client (Windows), files are always ready, and sockets and pipes are
+ * served by the same epoll_wait.
+ */
+#include "../epoll.h"
+#include "third_party/socketpair.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAILED %s:%d %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+#ifdef _WIN32
+typedef HANDLE pipe_t;
+
+static HANDLE pipeserver(wchar_t* name, size_t len) {
+    static LONG serial = 0;
+    swprintf(name, len, L"\\\\.\\pipe\\epoll_handle_test.%lu.%ld", GetCurrentProcessId(), InterlockedIncrement(&serial));
+    return CreateNamedPipeW(name, PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 4096, 4096, 0, NULL);
+}
+
+/*p[0] the overlapped server end that is polled, p[1] a plain client end*/
+static int makepipe(pipe_t p[2]) {
+    wchar_t name[128];
+    p[0] = pipeserver(name, 128);
+    if (p[0] == INVALID_HANDLE_VALUE)
+        return -1;
+    p[1] = CreateFileW(name, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    return p[1] == INVALID_HANDLE_VALUE ? -1 : 0;
+}
+
+static int readpipe(pipe_t p, char* buf, int len) {
+    OVERLAPPED ol = {};
+    DWORD n = 0;
+    ol.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if ((ReadFile(p, buf, len, NULL, &ol) || GetLastError() == ERROR_IO_PENDING) &&
+        GetOverlappedResult(p, &ol, &n, TRUE)) {
+        CloseHandle(ol.hEvent);
+        return (int)n;
+    }
+    CloseHandle(ol.hEvent);
+    return -1;
+}
+
+static int writepipe(pipe_t p, const char* buf, int len) {
+    DWORD n = 0;
+    return WriteFile(p, buf, len, &n, NULL) ? (int)n : -1;
+}
+
+static void closepipe(pipe_t p) {
+    CloseHandle(p);
+}
+
+static int pipe2fd(pipe_t p) {
+    return epoll_handle2fd((uintptr_t)p, EPOLL_HANDLE_PIPE);
+}
+
+static int tempfile2fd(HANDLE* h) {
+    *h = CreateFileW(L"epoll_handle_test.tmp", GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    return *h == INVALID_HANDLE_VALUE ? -1 : epoll_handle2fd((uintptr_t)*h, EPOLL_HANDLE_FILE);
+}
+
+static void closefile(HANDLE h) {
+    CloseHandle(h);
+}
+#else
+typedef int pipe_t;
+
+static int makepipe(pipe_t p[2]) {
+    return pipe(p);
+}
+
+static int readpipe(pipe_t p, char* buf, int len) {
+    return (int)read(p, buf, len);
+}
+
+static int writepipe(pipe_t p, const char* buf, int len) {
+    return (int)write(p, buf, len);
+}
+
+static void closepipe(pipe_t p) {
+    close(p);
+}
+
+static int pipe2fd(pipe_t p) {
+    return epoll_handle2fd((uintptr_t)p, EPOLL_HANDLE_PIPE);
+}
+
+static int tempfile2fd(FILE** f) {
+    *f = tmpfile();
+    return *f == NULL ? -1 : epoll_handle2fd((uintptr_t)fileno(*f), EPOLL_HANDLE_FILE);
+}
+
+static void closefile(FILE* f) {
+    fclose(f);
+}
+#endif
+
+static int addfd(int epfd, int fd, uint32_t events) {
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void test_pipe() {
+    epoll_event ev[4];
+    pipe_t p[2];
+    char buf[16];
+    int epfd, fd;
+
+    printf("a pipe is readable while it holds data and hangs up with its writer\n");
+    CHECK(makepipe(p) == 0);
+    epfd = epoll_create(4);
+    fd = pipe2fd(p[0]);
+    CHECK(fd > 0);
+    CHECK(addfd(epfd, fd, EPOLLIN | EPOLLRDHUP) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 0) == 0);
+    CHECK(writepipe(p[1], "abc", 3) == 3);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLIN) && ev[0].data.fd == fd);
+    /*level triggered, still readable*/
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLIN));
+    CHECK(readpipe(p[0], buf, sizeof(buf)) == 3);
+    CHECK(epoll_wait(epfd, ev, 4, 30) == 0);
+    /*data written while the poll is outstanding*/
+    CHECK(writepipe(p[1], "d", 1) == 1);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLIN));
+    CHECK(readpipe(p[0], buf, sizeof(buf)) == 1);
+    CHECK(epoll_wait(epfd, ev, 4, 30) == 0);
+    closepipe(p[1]);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLHUP));
+    CHECK(epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) == 0);
+    epoll_close(epfd);
+    epoll_freefd(fd);
+    closepipe(p[0]);
+}
+
+static void test_pipe_writable() {
+    epoll_event ev[4];
+    pipe_t p[2];
+    int epfd, fd;
+
+    printf("a pipe's write end is writable\n");
+    CHECK(makepipe(p) == 0);
+    epfd = epoll_create(4);
+    fd = pipe2fd(p[1]);
+    CHECK(addfd(epfd, fd, EPOLLOUT | EPOLLONESHOT) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && ev[0].events == EPOLLOUT && ev[0].data.fd == fd);
+    CHECK(epoll_wait(epfd, ev, 4, 30) == 0);
+    epoll_close(epfd);
+    epoll_freefd(fd);
+    closepipe(p[0]);
+    closepipe(p[1]);
+}
+
+#ifdef _WIN32
+static void test_pipe_server() {
+    epoll_event ev[4];
+    wchar_t name[128];
+    HANDLE server, client;
+    int epfd, fd;
+
+    printf("a named pipe server reports its client\n");
+    server = pipeserver(name, 128);
+    CHECK(server != INVALID_HANDLE_VALUE);
+    epfd = epoll_create(4);
+    fd = pipe2fd(server);
+    CHECK(addfd(epfd, fd, EPOLLIN) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 30) == 0);
+    client = CreateFileW(name, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    CHECK(client != INVALID_HANDLE_VALUE);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLIN) && ev[0].data.fd == fd);
+    /*connected, readable again only with data*/
+    CHECK(epoll_wait(epfd, ev, 4, 30) == 0);
+    CHECK(writepipe(client, "x", 1) == 1);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && (ev[0].events & EPOLLIN));
+    epoll_close(epfd);
+    epoll_freefd(fd);
+    CloseHandle(client);
+    CloseHandle(server);
+}
+#endif
+
+static void test_file() {
+    epoll_event ev[4];
+    epoll_event mod = {};
+    struct epoll_iobuf iobuf;
+    char mem[16];
+#ifdef _WIN32
+    HANDLE f;
+#else
+    FILE* f;
+#endif
+    int epfd, epfd2, fd;
+
+    printf("a regular file is always ready\n");
+    fd = tempfile2fd(&f);
+    CHECK(fd > 0);
+    epfd = epoll_create(4);
+    CHECK(addfd(epfd, fd, EPOLLIN | EPOLLOUT) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && ev[0].events == (EPOLLIN | EPOLLOUT) && ev[0].data.fd == fd);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && ev[0].events == (EPOLLIN | EPOLLOUT));
+    mod.events = EPOLLIN | EPOLLONESHOT;
+    mod.data.fd = fd;
+    CHECK(epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &mod) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 1000) == 1 && ev[0].events == EPOLLIN);
+    CHECK(epoll_wait(epfd, ev, 4, 30) == 0);
+    /*nothing else ever becomes ready, the poll is only deleted*/
+    mod.events = EPOLLPRI;
+    CHECK(epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &mod) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 30) == 0);
+    CHECK(epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) == 0);
+    CHECK(epoll_wait(epfd, ev, 4, 0) == 0);
+    /*polled by the engine, neither exclusive nor submitted to*/
+    epfd2 = epoll_create(4);
+    CHECK(addfd(epfd2, fd, EPOLLIN | EPOLLEXCLUSIVE) < 0 && errno == EINVAL);
+    iobuf.data = mem;
+    iobuf.size = sizeof(mem);
+    CHECK(epoll_register_buffers(epfd2, &iobuf, 1) == 0);
+    CHECK(epoll_submit_recv(epfd2, fd, 0, mod.data) < 0 && errno == EBADF);
+    epoll_close(epfd2);
+    epoll_close(epfd);
+    epoll_freefd(fd);
+    closefile(f);
+}
+
+static void test_one_loop() {
+    epoll_event ev[4];
+    SOCKET s[2];
+    pipe_t p[2];
+    char buf[16];
+    int epfd, sfd, pfd, n, seen = 0;
+
+    printf("one epoll_wait serves a socket and a pipe\n");
+    CHECK(dumb_socketpair(s, 1) == 0);
+    CHECK(makepipe(p) == 0);
+    epfd = epoll_create(4);
+    sfd = epoll_sock2fd(s[0]);
+    pfd = pipe2fd(p[0]);
+    CHECK(addfd(epfd, sfd, EPOLLIN) == 0);
+    CHECK(addfd(epfd, pfd, EPOLLIN) == 0);
+    CHECK(send(s[1], "net", 3, 0) == 3);
+    CHECK(writepipe(p[1], "ipc", 3) == 3);
+    while (seen != 3) {
+        n = epoll_wait(epfd, ev, 4, 1000);
+        if (n <= 0)
+            break;
+        for (int i = 0; i < n; i++) {
+            if (ev[i].data.fd == sfd && recv(s[0], buf, sizeof(buf), 0) == 3)
+                seen |= 1;
+            if (ev[i].data.fd == pfd && readpipe(p[0], buf, sizeof(buf)) == 3)
+                seen |= 2;
+        }
+    }
+    CHECK(seen == 3);
+    epoll_close(epfd);
+    epoll_freefd(sfd);
+    epoll_freefd(pfd);
+    closesocket(s[0]);
+    closesocket(s[1]);
+    closepipe(p[0]);
+    closepipe(p[1]);
+}
+
+int main() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    test_pipe();
+    test_pipe_writable();
+#ifdef _WIN32
+    test_pipe_server();
+#endif
+    test_file();
+    test_one_loop();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
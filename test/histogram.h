@@ -0,0 +1,114 @@
+/*@file histogram.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+/*
+ * HDR style latency histogram: values below 2^HIST_SUB_BITS get a bucket
+ * each, above that every power of two is split into 2^(HIST_SUB_BITS-1)
+ * buckets, so any 64 bit value is recorded within 1/64 of itself in a fixed
+ * 30KB table. Recording is a few shifts and an increment, cheap enough
+ * for the measured path; per-thread histograms are merged afterwards.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#define HIST_SUB_BITS 7
+#define HIST_SUB_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_COUNTS   ((64 - HIST_SUB_BITS + 2) * HIST_SUB_HALF)
+
+typedef struct _histogram {
+    uint64_t counts[HIST_COUNTS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+} histogram, *phistogram;
+
+static inline int _hist_msb(uint64_t v) {
+    int m = 0;
+    while (v >>= 1)
+        m++;
+    return m;
+}
+
+static inline int _hist_index(uint64_t v) {
+    int e;
+    if (v < (1 << HIST_SUB_BITS))
+        return (int)v;
+    e = _hist_msb(v) - HIST_SUB_BITS + 1;
+    return (e << (HIST_SUB_BITS - 1)) + (int)(v >> e);
+}
+
+/*highest value recorded in bucket idx*/
+static inline uint64_t _hist_value(int idx) {
+    int e;
+    if (idx < (1 << HIST_SUB_BITS))
+        return (uint64_t)idx;
+    e = (idx >> (HIST_SUB_BITS - 1)) - 1;
+    return ((uint64_t)(idx - (e << (HIST_SUB_BITS - 1))) << e) + (((uint64_t)1 << e) - 1);
+}
+
+static inline void hist_init(phistogram h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline void hist_record(phistogram h, uint64_t v) {
+    h->counts[_hist_index(v)]++;
+    h->total++;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static inline void hist_merge(phistogram to, const histogram* from) {
+    for (int n = 0; n < HIST_COUNTS; n++)
+        to->counts[n] += from->counts[n];
+    to->total += from->total;
+    if (from->min < to->min)
+        to->min = from->min;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+/*value at percentile q (0-100), 0 when empty*/
+static inline uint64_t hist_percentile(const histogram* h, double q) {
+    uint64_t want, seen = 0;
+    uint64_t v;
+
+    if (h->total == 0)
+        return 0;
+    want = (uint64_t)(q / 100.0 * h->total + 0.5);
+    if (want < 1)
+        want = 1;
+    for (int n = 0; n < HIST_COUNTS; n++) {
+        seen += h->counts[n];
+        if (seen >= want) {
+            v = _hist_value(n);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
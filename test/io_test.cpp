@@ -0,0 +1,200 @@
+/*@file io_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * epoll_submit_recv/send on socket pairs with the platform backend: data
+ * already queued and data that arrives later, sends, EOF, buffer checks, a
+ * bulk stream driven only by completions, and closing an instance with an
+ * operation in flight.
+ */
+#include "../epoll.h"
+#include "third_party/socketpair.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+
+#define BUFS 4
+#define BUFSIZE 4096
+#define STREAM (8 * 1024 * 1024)
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAILED %s:%d %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+struct iopair {
+    SOCKET s[2];
+    int fd;
+    int epfd;
+    char mem[BUFS][BUFSIZE];
+    struct epoll_iobuf bufs[BUFS];
+
+    iopair() {
+        int n;
+        epfd = epoll_create(4);
+        CHECK(dumb_socketpair(s, 1) == 0);
+        setnonblocking(s[0]);
+        fd = epoll_sock2fd(s[0]);
+        for (n = 0; n < BUFS; n++) {
+            bufs[n].data = mem[n];
+            bufs[n].size = BUFSIZE;
+        }
+        CHECK(epoll_register_buffers(epfd, bufs, BUFS) == 0);
+    }
+
+    ~iopair() {
+        epoll_close(epfd);
+        epoll_freefd(fd);
+        closesocket(s[0]);
+        if (s[1] != INVALID_SOCKET)
+            closesocket(s[1]);
+    }
+
+    /*one completion, or an empty event on timeout*/
+    epoll_event wait(int timeout = 2000) {
+        epoll_event ev = {};
+        if (epoll_wait(epfd, &ev, 1, timeout) != 1)
+            ev.events = 0;
+        return ev;
+    }
+};
+
+static epoll_data_t tag(uint64_t v) {
+    epoll_data_t data;
+    data.u64 = v;
+    return data;
+}
+
+static void test_recv() {
+    iopair p;
+    epoll_event ev;
+    char rbuf[8];
+
+    printf("recv completes with data that is queued or arrives later\n");
+    CHECK(send(p.s[1], "hello", 5, 0) == 5);
+    CHECK(epoll_submit_recv(p.epfd, p.fd, 0, tag(1)) == 0);
+    ev = p.wait();
+    CHECK(ev.events == (EPOLLCOMPLETE | EPOLLIN) && ev.data.u64 == 1);
+    CHECK(p.bufs[0].len == 5 && p.bufs[0].error == 0 && memcmp(p.mem[0], "hello", 5) == 0);
+
+    CHECK(epoll_submit_recv(p.epfd, p.fd, 1, tag(2)) == 0);
+    CHECK(p.wait(50).events == 0);
+    CHECK(send(p.s[1], "later", 5, 0) == 5);
+    ev = p.wait();
+    CHECK(ev.events == (EPOLLCOMPLETE | EPOLLIN) && ev.data.u64 == 2);
+    CHECK(p.bufs[1].len == 5 && memcmp(p.mem[1], "later", 5) == 0);
+
+    memcpy(p.mem[2], "out", 3);
+    CHECK(epoll_submit_send(p.epfd, p.fd, 2, 3, tag(3)) == 0);
+    ev = p.wait();
+    CHECK(ev.events == (EPOLLCOMPLETE | EPOLLOUT) && ev.data.u64 == 3 && p.bufs[2].len == 3);
+    CHECK(recv(p.s[1], rbuf, sizeof rbuf, 0) == 3 && memcmp(rbuf, "out", 3) == 0);
+}
+
+static void test_checks() {
+    iopair p;
+
+    printf("buffers are checked and used by one operation at a time\n");
+    CHECK(epoll_submit_recv(p.epfd, p.fd, BUFS, tag(0)) < 0 && errno == EINVAL);
+    CHECK(epoll_submit_send(p.epfd, p.fd, 0, BUFSIZE + 1, tag(0)) < 0 && errno == EINVAL);
+    CHECK(epoll_submit_recv(p.epfd, p.fd, 0, tag(0)) == 0);
+    CHECK(epoll_submit_recv(p.epfd, p.fd, 0, tag(0)) < 0 && errno == EBUSY);
+    CHECK(epoll_register_buffers(p.epfd, p.bufs, BUFS) < 0 && errno == EBUSY);
+    /*EOF completes the pending recv with 0 bytes*/
+    closesocket(p.s[1]);
+    p.s[1] = INVALID_SOCKET;
+    CHECK(p.wait().events == (EPOLLCOMPLETE | EPOLLIN));
+    CHECK(p.bufs[0].len == 0);
+    CHECK(epoll_register_buffers(p.epfd, p.bufs, BUFS) == 0);
+}
+
+static void test_stream() {
+    iopair p;
+    std::vector<char> out(BUFSIZE, 'x');
+    epoll_event ev;
+    size_t sent = 0, received = 0;
+    int n, ret;
+
+    printf("a %d byte stream is received through completions only\n", STREAM);
+    setnonblocking(p.s[1]);
+    for (n = 0; n < BUFS; n++)
+        CHECK(epoll_submit_recv(p.epfd, p.fd, n, tag(n)) == 0);
+    while (received < STREAM) {
+        while (sent < STREAM) {
+            ret = send(p.s[1], out.data(), (int)(STREAM - sent < BUFSIZE ? STREAM - sent : BUFSIZE), 0);
+            if (ret <= 0)
+                break;
+            sent += ret;
+        }
+        ev = p.wait();
+        if (ev.events != (EPOLLCOMPLETE | EPOLLIN) || p.bufs[ev.data.u64].len == 0)
+            break;
+        received += p.bufs[ev.data.u64].len;
+        if (received < STREAM)
+            epoll_submit_recv(p.epfd, p.fd, (uint32_t)ev.data.u64, ev.data);
+    }
+    CHECK(received == STREAM);
+}
+
+static void test_close_inflight() {
+    printf("closing an instance cancels what is in flight\n");
+    {
+        iopair p;
+        CHECK(epoll_submit_recv(p.epfd, p.fd, 0, tag(0)) == 0);
+    }
+    /*the buffers went with the instance, nothing may write to them now*/
+    iopair q;
+    CHECK(send(q.s[1], "x", 1, 0) == 1);
+    CHECK(epoll_submit_recv(q.epfd, q.fd, 0, tag(0)) == 0);
+    CHECK(q.wait().events == (EPOLLCOMPLETE | EPOLLIN));
+}
+
+int main() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    test_recv();
+    test_checks();
+    test_stream();
+    test_close_inflight();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
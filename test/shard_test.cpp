@@ -0,0 +1,265 @@
+/*@file shard_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * EPOLL_SHARDED instances on the simulated backend: registrations are
+ * spread over the ports, a single waiter still sees every socket (by
+ * stealing from the ports that are not its home), a waiter blocked on its
+ * home port notices readiness on another one, several waiters drain
+ * oneshot registrations exactly once between them, and sockets with a
+ * worker affinity are left to that worker's waiter.
+ */
+#include "../epoll_sim.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define SOCKETS 64
+#define ROUNDS 200
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAILED %s:%d %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+struct simset {
+    int epfd;
+    socket_t s[SOCKETS];
+    int fd[SOCKETS];
+
+    simset(int flags, uint32_t events) {
+        epfd = epoll_create1(flags);
+        for (int n = 0; n < SOCKETS; n++) {
+            epoll_event ev = {};
+            s[n] = epoll_sim_socket();
+            fd[n] = epoll_sock2fd(s[n]);
+            ev.events = events;
+            ev.data.u32 = (uint32_t)n;
+            CHECK(epoll_ctl(epfd, EPOLL_CTL_ADD, fd[n], &ev) == 0);
+        }
+    }
+    ~simset() {
+        for (int n = 0; n < SOCKETS; n++) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, fd[n], NULL);
+            epoll_freefd(fd[n]);
+            epoll_sim_close(s[n]);
+        }
+        epoll_close(epfd);
+    }
+};
+
+static void test_one_waiter() {
+    simset set(EPOLL_SHARDS(4), EPOLLIN | EPOLLONESHOT);
+    epoll_event ev[SOCKETS];
+    struct epoll_handleinfo hi;
+    struct epoll_stats st;
+    std::vector<int> seen(SOCKETS);
+    int got = 0, n, k;
+
+    printf("one waiter collects the sockets of every port\n");
+    CHECK(epoll_wait(set.epfd, ev, SOCKETS, 0) == 0);
+    CHECK(epoll_handleinfo(set.epfd, &hi) == 0 && hi.sockets == SOCKETS);
+    for (n = 0; n < SOCKETS; n++)
+        epoll_sim_ready(set.s[n], EPOLLIN);
+    /*one port per dequeue, a handful of waits*/
+    for (k = 0; k < 16 && got < SOCKETS; k++) {
+        n = epoll_wait(set.epfd, ev, SOCKETS, 1000);
+        for (int i = 0; i < n; i++) {
+            seen[ev[i].data.u32]++;
+            got++;
+        }
+    }
+    CHECK(got == SOCKETS);
+    for (n = 0; n < SOCKETS; n++)
+        CHECK(seen[n] == 1);
+    CHECK(epoll_wait(set.epfd, ev, SOCKETS, 20) == 0);
+    if (epoll_stats(set.epfd, &st) == 0)
+        CHECK(st.steals >= 3);
+}
+
+static void test_wakes_across_ports() {
+    simset set(EPOLL_SHARDS(4), EPOLLIN);
+    epoll_event ev[4];
+    long long took = 0;
+    int n = 0;
+
+    printf("a blocked waiter sees readiness on any port\n");
+    CHECK(epoll_wait(set.epfd, ev, 4, 0) == 0);
+    for (int k = 0; k < 4; k++) {
+        std::thread t([&] {
+            auto start = std::chrono::steady_clock::now();
+            n = epoll_wait(set.epfd, ev, 4, 5000);
+            took = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        epoll_sim_ready(set.s[k], EPOLLIN);
+        t.join();
+        CHECK(n == 1 && ev[0].data.u32 == (uint32_t)k && took < 1000);
+        epoll_sim_drain(set.s[k], EPOLLIN);
+        /*the level triggered poll is redone on the drained socket*/
+        CHECK(epoll_wait(set.epfd, ev, 4, 0) == 0);
+    }
+
+    printf("epoll_postqueued and epoll_close wake sharded waiters\n");
+    std::thread t([&] { n = epoll_wait(set.epfd, ev, 4, 5000); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    epoll_postqueued(set.epfd);
+    t.join();
+    CHECK(n == 0);
+}
+
+static void test_many_waiters() {
+    simset set(EPOLL_SHARDS(4), EPOLLIN | EPOLLONESHOT);
+    std::vector<std::atomic<int>> inside(SOCKETS);
+    std::vector<std::atomic<int>> count(SOCKETS);
+    std::vector<std::thread> waiters;
+    std::atomic<int> total(0);
+    std::atomic<int> stop(0);
+    std::atomic<int> overlapped(0);
+
+    printf("%d waiters share oneshot sockets over 4 ports\n", 4);
+    for (int n = 0; n < SOCKETS; n++)
+        inside[n] = count[n] = 0;
+    for (int w = 0; w < 4; w++) {
+        waiters.emplace_back([&] {
+            epoll_event ev[8];
+            while (stop.load() == 0) {
+                int n = epoll_wait(set.epfd, ev, 8, 20);
+                for (int i = 0; i < n; i++) {
+                    uint32_t k = ev[i].data.u32;
+                    if (inside[k].exchange(1) != 0)
+                        overlapped++;
+                    epoll_sim_drain(set.s[k], EPOLLIN);
+                    count[k]++;
+                    total++;
+                    inside[k] = 0;
+                    ev[i].events = EPOLLIN | EPOLLONESHOT;
+                    epoll_ctl(set.epfd, EPOLL_CTL_MOD, set.fd[k], &ev[i]);
+                }
+            }
+        });
+    }
+    /*the next round only once every socket was handled*/
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int n = 0; n < SOCKETS; n++)
+            epoll_sim_ready(set.s[n], EPOLLIN);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (total.load() < (r + 1) * SOCKETS && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+    }
+    stop = 1;
+    for (auto& t : waiters)
+        t.join();
+    CHECK(total.load() == ROUNDS * SOCKETS);
+    CHECK(overlapped.load() == 0);
+    for (int n = 0; n < SOCKETS; n++)
+        CHECK(count[n].load() == ROUNDS);
+}
+
+static void test_affinity() {
+    simset set(EPOLL_SHARDS(4), EPOLLIN);
+    epoll_event ev[4], e = {};
+    struct epoll_slabinfo si;
+    struct epoll_stats st;
+    int n = 0;
+
+    printf("epoll_ctl_affinity places sockets on their worker's port\n");
+    e.events = EPOLLIN;
+    e.data.u32 = 0;
+    CHECK(epoll_ctl_affinity(set.epfd, EPOLL_CTL_DEL, set.fd[0], &e, 0) < 0 && errno == EINVAL);
+    CHECK(epoll_ctl_affinity(set.epfd, EPOLL_CTL_MOD, set.fd[0], &e, -2) < 0 && errno == EINVAL);
+    CHECK(epoll_setworker(-2) < 0 && errno == EINVAL);
+    /*oneshot, a level triggered re-report could go to either waiter*/
+    e.events = EPOLLIN | EPOLLONESHOT;
+    for (int k = 0; k < 2; k++) {
+        e.data.u32 = (uint32_t)k;
+        CHECK(epoll_ctl_affinity(set.epfd, EPOLL_CTL_MOD, set.fd[k], &e, k + 4) == 0);
+    }
+    /*the records replaced are freed once their cancelled polls are dequeued, a port per wait*/
+    for (int k = 0; k < 4; k++)
+        CHECK(epoll_wait(set.epfd, ev, 4, 0) == 0);
+    CHECK(epoll_slabinfo(set.epfd, &si) == 0 && si.inuse == SOCKETS);
+
+    printf("a port with its own waiter is not stolen from\n");
+    CHECK(epoll_setworker(0) == 0);
+    std::thread t([&] {
+        epoll_setworker(1);
+        n = epoll_wait(set.epfd, ev, 4, 5000);
+        epoll_setworker(-1);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    epoll_sim_ready(set.s[1], EPOLLIN);
+    epoll_event mine[4];
+    CHECK(epoll_wait(set.epfd, mine, 4, 0) == 0);
+    t.join();
+    CHECK(n == 1 && ev[0].data.u32 == 1);
+    epoll_sim_drain(set.s[1], EPOLLIN);
+
+    /*worker 0 takes its socket from home, no steal*/
+    uint64_t steals = epoll_stats(set.epfd, &st) == 0 ? st.steals : 0;
+    epoll_sim_ready(set.s[0], EPOLLIN);
+    n = epoll_wait(set.epfd, ev, 4, 1000);
+    CHECK(n == 1 && ev[0].data.u32 == 0);
+    epoll_sim_drain(set.s[0], EPOLLIN);
+    if (epoll_stats(set.epfd, &st) == 0)
+        CHECK(st.steals == steals);
+
+    printf("moving a socket to another worker keeps it registered\n");
+    e.data.u32 = 1;
+    CHECK(epoll_ctl_affinity(set.epfd, EPOLL_CTL_MOD, set.fd[1], &e, 0) == 0);
+    for (int k = 0; k < 4; k++)
+        CHECK(epoll_wait(set.epfd, ev, 4, 0) == 0);
+    epoll_sim_ready(set.s[1], EPOLLIN);
+    n = epoll_wait(set.epfd, ev, 4, 1000);
+    CHECK(n == 1 && ev[0].data.u32 == 1);
+    epoll_sim_drain(set.s[1], EPOLLIN);
+    CHECK(epoll_wait(set.epfd, ev, 4, 0) == 0);
+    CHECK(epoll_slabinfo(set.epfd, &si) == 0 && si.inuse == SOCKETS);
+    epoll_setworker(-1);
+}
+
+int main() {
+    epoll_setbackend(&epoll_backend_sim);
+
+    test_one_waiter();
+    test_wakes_across_ports();
+    test_many_waiters();
+    test_affinity();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
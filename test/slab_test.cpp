@@ -0,0 +1,179 @@
+/*@file slab_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * slab pools on their own: objects are zeroed and cache line aligned,
+ * freed objects are handed out again LIFO, slab_reserve grows just enough
+ * for the allocations that follow and slab_destroy leaves an empty pool
+ * that can be used again. epoll_create(size) is checked to reserve its
+ * records up front.
+ */
+#include "../slab.h"
+#include "../epoll.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAILED %s:%d %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+#define OBJSIZE 40
+#define PERSLAB 16
+
+static int zeroed(void* obj, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (((unsigned char*)obj)[i] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void test_alloc_free() {
+    slab_pool pool;
+    void* objs[PERSLAB * 2 + 1];
+    void* obj;
+    int i, ok = 1;
+
+    printf("objects are zeroed, aligned and reused last freed first\n");
+    slab_init(&pool, OBJSIZE, PERSLAB);
+    CHECK(pool.objsize == SLAB_CACHELINE);
+    CHECK(pool.nslabs == 0 && pool.capacity == 0 && pool.inuse == 0);
+
+    for (i = 0; i < PERSLAB * 2 + 1; i++) {
+        objs[i] = slab_alloc(&pool);
+        if (objs[i] == NULL || ((uintptr_t)objs[i] & (SLAB_CACHELINE - 1)) != 0 || !zeroed(objs[i], pool.objsize))
+            ok = 0;
+        else
+            memset(objs[i], 0xa5, pool.objsize);
+    }
+    CHECK(ok);
+    CHECK(pool.nslabs == 3 && pool.capacity == PERSLAB * 3 && pool.inuse == PERSLAB * 2 + 1);
+
+    slab_free(&pool, objs[3]);
+    slab_free(&pool, objs[7]);
+    CHECK(pool.inuse == PERSLAB * 2 - 1);
+    obj = slab_alloc(&pool);
+    CHECK(obj == objs[7] && zeroed(obj, pool.objsize));
+    obj = slab_alloc(&pool);
+    CHECK(obj == objs[3] && zeroed(obj, pool.objsize));
+    CHECK(pool.nslabs == 3);
+
+    slab_free(&pool, NULL);
+    CHECK(pool.inuse == PERSLAB * 2 + 1);
+    for (i = 0; i < PERSLAB * 2 + 1; i++)
+        slab_free(&pool, objs[i]);
+    CHECK(pool.inuse == 0 && pool.capacity == PERSLAB * 3);
+
+    slab_destroy(&pool);
+    CHECK(pool.nslabs == 0 && pool.capacity == 0 && pool.inuse == 0 && pool.slabs == NULL);
+    CHECK(pool.objsize == SLAB_CACHELINE && pool.perslab == PERSLAB);
+
+    /*a destroyed pool grows again*/
+    obj = slab_alloc(&pool);
+    CHECK(obj != NULL && pool.nslabs == 1);
+    slab_free(&pool, obj);
+    slab_destroy(&pool);
+}
+
+static void test_reserve() {
+    slab_pool pool;
+    void* objs[PERSLAB * 3];
+    int i, ok = 1;
+
+    printf("slab_reserve grows only as far as the free objects fall short\n");
+    slab_init(&pool, OBJSIZE, PERSLAB);
+
+    CHECK(slab_reserve(&pool, 0) == 0 && pool.nslabs == 0);
+    CHECK(slab_reserve(&pool, PERSLAB + 1) == 0);
+    CHECK(pool.nslabs == 2 && pool.capacity == PERSLAB * 2);
+    CHECK(slab_reserve(&pool, PERSLAB * 2) == 0 && pool.nslabs == 2);
+
+    for (i = 0; i < PERSLAB * 2; i++) {
+        if ((objs[i] = slab_alloc(&pool)) == NULL)
+            ok = 0;
+    }
+    CHECK(ok);
+    CHECK(pool.nslabs == 2);
+
+    /*the reservation counts objects in use*/
+    CHECK(slab_reserve(&pool, 1) == 0 && pool.nslabs == 3);
+    for (i = PERSLAB * 2; i < PERSLAB * 3; i++)
+        objs[i] = slab_alloc(&pool);
+    CHECK(pool.nslabs == 3 && pool.inuse == PERSLAB * 3);
+    for (i = 0; i < PERSLAB * 3; i++)
+        slab_free(&pool, objs[i]);
+    CHECK(slab_reserve(&pool, PERSLAB * 3) == 0 && pool.nslabs == 3);
+
+    slab_destroy(&pool);
+}
+
+static void test_node() {
+    slab_pool pool;
+    void* obj;
+
+    printf("slabs placed on a node are usable and released\n");
+    slab_init(&pool, OBJSIZE, PERSLAB);
+    slab_setnode(&pool, 0);
+    obj = slab_alloc(&pool);
+    CHECK(obj != NULL && zeroed(obj, pool.objsize));
+    slab_free(&pool, obj);
+    slab_destroy(&pool);
+    CHECK(pool.node == 0 && pool.nslabs == 0);
+}
+
+static void test_create_reserve() {
+    struct epoll_slabinfo si;
+    int epfd;
+
+    printf("epoll_create(size) reserves size records\n");
+    epfd = epoll_create(1000);
+    CHECK(epfd > 0);
+    CHECK(epoll_slabinfo(epfd, &si) == 0 && si.capacity >= 1000 && si.inuse == 0);
+    epoll_close(epfd);
+
+    epfd = epoll_create1(0);
+    CHECK(epfd > 0);
+    CHECK(epoll_slabinfo(epfd, &si) == 0 && si.capacity < 1000);
+    epoll_close(epfd);
+}
+
+int main() {
+    test_alloc_free();
+    test_reserve();
+    test_node();
+    test_create_reserve();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
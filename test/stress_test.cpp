@@ -0,0 +1,209 @@
+/*@file stress_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Several threads wait on one epoll instance while a producer keeps every
+ * socket readable. Registrations are EPOLLONESHOT and re-armed with
+ * EPOLL_CTL_MOD by the thread that handled them, so each readiness must be
+ * delivered to exactly one thread: two threads inside the same socket, an
+ * event with nothing to read or a byte never read is a failure.
+ *
+ * usage: stress_test [threads] [sockets] [rounds] [ports]
+ * with ports the instance is EPOLL_SHARDED over that many completion ports.
+ */
+#include "../epoll.h"
+#include "third_party/socketpair.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+
+struct stresssock {
+    SOCKET s[2];
+    int fd;
+    std::atomic<int> inflight;
+    std::atomic<size_t> received;
+};
+
+struct stressthread {
+    size_t events;
+    size_t empty;
+    size_t overlapped;
+    struct epoll_threadstats stats;
+};
+
+static int epfd;
+static std::vector<stresssock> socks;
+static std::atomic<size_t> totalreceived(0);
+static std::atomic<int> stop(0);
+
+static void worker(stressthread* self) {
+    epoll_event _event[16];
+    char rbuf[256];
+
+    while (stop.load() == 0) {
+        int fds = epoll_wait(epfd, _event, 16, 50);
+        for (int n = 0; n < fds; n++) {
+            stresssock& sock = socks[_event[n].data.u32];
+            size_t got = 0;
+            int len;
+
+            if (sock.inflight.exchange(1) != 0)
+                self->overlapped++;
+
+            while ((len = recv(sock.s[0], rbuf, sizeof rbuf, 0)) > 0)
+                got += len;
+
+            self->events++;
+            if (got == 0)
+                self->empty++;
+            sock.received += got;
+            totalreceived += got;
+            sock.inflight = 0;
+
+            _event[n].events = EPOLLIN | EPOLLONESHOT;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, sock.fd, &_event[n]);
+        }
+    }
+
+    epoll_threadstats(&self->stats);
+}
+
+int main(int argc, char* argv[]) {
+    size_t nthreads = argc > 1 ? atoi(argv[1]) : 8;
+    size_t nsocks = argc > 2 ? atoi(argv[2]) : 64;
+    size_t rounds = argc > 3 ? atoi(argv[3]) : 500;
+    int ports = argc > 4 ? atoi(argv[4]) : 0;
+    std::vector<stressthread> stats(nthreads);
+    std::vector<std::thread> workers;
+    size_t events = 0, empty = 0, overlapped = 0;
+    int failed = 0;
+
+#ifdef _WIN32
+    WSADATA WSAData;
+    WSAStartup(0x0202, &WSAData);
+#endif
+
+    epfd = ports > 0 ? epoll_create1(EPOLL_SHARDS(ports)) : epoll_create((int)nsocks);
+    if (epfd < 0) {
+        printf("epoll_create failed, errno:%d\n", errno);
+        return 1;
+    }
+
+    socks = std::vector<stresssock>(nsocks);
+    for (size_t n = 0; n < nsocks; n++) {
+        epoll_event _event = {};
+        if (dumb_socketpair(socks[n].s, 0) != 0) {
+            printf("socketpair failed, err:%d\n", WSAGetLastError());
+            return 1;
+        }
+        setnonblocking(socks[n].s[0]);
+        socks[n].fd = epoll_sock2fd(socks[n].s[0]);
+        _event.events = EPOLLIN | EPOLLONESHOT;
+        _event.data.u32 = (uint32_t)n;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, socks[n].fd, &_event) < 0) {
+            printf("epoll_ctl failed, errno:%d\n", errno);
+            return 1;
+        }
+    }
+
+    for (size_t n = 0; n < nthreads; n++)
+        workers.emplace_back(worker, &stats[n]);
+
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < nsocks; n++)
+            send(socks[n].s[1], ".", 1, 0);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (totalreceived.load() < rounds * nsocks && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    stop = 1;
+    for (auto& w : workers)
+        w.join();
+
+    for (size_t n = 0; n < nthreads; n++) {
+        printf("thread %zu: events:%zu waits:%llu contended:%llu contention:%llu usec\n", n,
+            stats[n].events, (unsigned long long)stats[n].stats.waits,
+            (unsigned long long)stats[n].stats.contended,
+            (unsigned long long)(stats[n].stats.contention_ns / 1000));
+        events += stats[n].events;
+        empty += stats[n].empty;
+        overlapped += stats[n].overlapped;
+    }
+
+    for (size_t n = 0; n < nsocks; n++) {
+        if (socks[n].received.load() != rounds) {
+            printf("  FAILED socket %zu received %zu of %zu bytes\n", n, socks[n].received.load(), rounds);
+            failed = 1;
+        }
+    }
+    if (overlapped != 0) {
+        printf("  FAILED %zu events delivered to a second thread\n", overlapped);
+        failed = 1;
+    }
+    if (empty != 0) {
+        printf("  FAILED %zu events with nothing to read\n", empty);
+        failed = 1;
+    }
+
+    printf("events:%zu bytes:%zu\n", events, totalreceived.load());
+
+    {
+        struct epoll_stats is;
+        if (epoll_stats(epfd, &is) == 0) {
+            printf("instance: waits:%llu completions:%llu filtered:%llu polls:%llu rearms:%llu cancels:%llu contended:%llu steals:%llu\n",
+                (unsigned long long)is.waits, (unsigned long long)is.completions,
+                (unsigned long long)is.filtered, (unsigned long long)is.polls,
+                (unsigned long long)is.rearms, (unsigned long long)is.cancels,
+                (unsigned long long)is.contended, (unsigned long long)is.steals);
+            if (is.events != events) {
+                printf("  FAILED instance counted %llu events, threads %zu\n", (unsigned long long)is.events, events);
+                failed = 1;
+            }
+        }
+    }
+
+    for (size_t n = 0; n < nsocks; n++) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, socks[n].fd, NULL);
+        epoll_freefd(socks[n].fd);
+        closesocket(socks[n].s[0]);
+        closesocket(socks[n].s[1]);
+    }
+    epoll_close(epfd);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+
+    printf(failed ? "failed\n" : "all passed\n");
+    return failed;
+}
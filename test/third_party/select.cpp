@@ -24,6 +24,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef _WIN32
 # include <ws2tcpip.h>
 # include <windows.h>
@@ -39,7 +40,7 @@
 #include <errno.h>
 #include "select.h"
 
-struct fd_set read_set, master_set;
+fd_set read_set, master_set;
 static int  max_sd = 0;
 
 void initselect()
@@ -50,6 +51,10 @@ void initselect()
 void addfd(SOCKET s)
 {
     FD_SET(s, &master_set);
+#ifndef _WIN32
+    if ((int)s >= max_sd)
+        max_sd = (int)s + 1;
+#endif
 }
 
 int selectdispatch()
@@ -66,6 +71,7 @@ int selectdispatch()
        return 0;
    }
 
+#ifdef _WIN32
    for (int i = 0; i < (int)read_set.fd_count; ++i)
    {
        if (FD_ISSET(read_set.fd_array[i], &read_set))
@@ -74,6 +80,16 @@ int selectdispatch()
            break;
        }
    } 
+#else
+   for (int i = 0; i < max_sd; ++i)
+   {
+       if (FD_ISSET(i, &read_set))
+       {
+           readcb(i);
+           break;
+       }
+   }
+#endif
 
    return 1;
 }
\ No newline at end of file
@@ -1,2 +1,4 @@
 //
+#include "../portable.h"
+
 int dumb_socketpair(SOCKET socks[2], int make_overlapped);
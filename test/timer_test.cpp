@@ -0,0 +1,352 @@
+/*@file timer_test.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Timer wheel checks: the wheel itself on virtual time (every timer fires
+ * on its tick, none early or late, cancel is final, the timeout is never
+ * past the next expiry), then the epoll_timer_* API through the engine on
+ * the simulated backend with the real clock, and the ns timeouts of
+ * epoll_pwait2 / epoll_wait_until.
+ */
+#include "../epoll_sim.h"
+#include "../timerwheel.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define TIMERS 200000
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAILED %s:%d %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+struct vtimer {
+    timer_node node;
+    uint64_t fired;
+    int cancelled;
+};
+
+struct vstate {
+    ptimer_wheel w;
+    uint64_t early, late;
+    uint64_t fired;
+};
+
+static void vexpire(ptimer_node n, void* arg) {
+    vstate* st = (vstate*)arg;
+    vtimer* t = (vtimer*)n;
+
+    if (st->w->now < n->expires)
+        st->early++;
+    else if (st->w->now > n->expires)
+        st->late++;
+    t->fired++;
+    st->fired++;
+}
+
+static void test_wheel() {
+    static timer_wheel w;
+    std::vector<vtimer> timers(TIMERS);
+    std::mt19937_64 rng(42);
+    vstate st = { &w, 0, 0, 0 };
+    uint64_t now = 1000, end, next, min;
+    uint64_t cancelled = 0, wrong = 0, premature = 0;
+    size_t n;
+
+    printf("wheel fires %d timers on their tick\n", TIMERS);
+    wheel_init(&w, now);
+    for (n = 0; n < timers.size(); n++) {
+        wheel_nodeinit(&timers[n].node);
+        timers[n].fired = 0;
+        timers[n].cancelled = 0;
+        /*mostly near, some on every level, a few past the top level*/
+        switch (rng() % 8) {
+        case 0: next = rng() % 256; break;
+        case 1: next = (uint64_t)1 << 33; break;
+        default: next = rng() % ((uint64_t)1 << (8 + 6 * (rng() % 4))); break;
+        }
+        wheel_add(&w, &timers[n].node, now + 1 + next);
+    }
+    /*cancel a tenth, re-add another tenth elsewhere*/
+    for (n = 0; n < timers.size(); n += 10) {
+        wheel_del(&w, &timers[n].node);
+        timers[n].cancelled = 1;
+        cancelled++;
+        if (n + 5 < timers.size())
+            wheel_add(&w, &timers[n + 5].node, now + 1 + rng() % 100000);
+    }
+    CHECK(w.count == TIMERS - cancelled);
+
+    end = now + ((uint64_t)1 << 33) + 1;
+    while (w.count > 0 && now < end) {
+        next = wheel_timeout(&w);
+        /*the timeout may be early (a cascade) but never past an expiry*/
+        min = UINT64_MAX;
+        if (rng() % 64 == 0) {
+            for (n = 0; n < timers.size(); n++) {
+                if (timers[n].node.level >= 0 && timers[n].node.expires < min)
+                    min = timers[n].node.expires;
+            }
+            if (now + next > min)
+                premature++;
+        }
+        /*jump by the timeout or by random steps*/
+        now += rng() % 2 ? next : 1 + rng() % 5000;
+        wheel_advance(&w, now, vexpire, &st);
+    }
+
+    for (n = 0; n < timers.size(); n++) {
+        if (timers[n].fired != (uint64_t)(timers[n].cancelled ? 0 : 1))
+            wrong++;
+    }
+    CHECK(w.count == 0);
+    CHECK(st.fired == TIMERS - cancelled);
+    CHECK(wrong == 0);
+    CHECK(premature == 0);
+    /*the callback runs on the expiry tick however far an advance goes*/
+    CHECK(st.early == 0 && st.late == 0);
+}
+
+static void test_wheel_exact() {
+    static timer_wheel w;
+    vtimer t[3];
+    vstate st = { &w, 0, 0, 0 };
+    uint64_t now = 5;
+    int n;
+
+    printf("wheel stepped by its timeout reaches every expiry\n");
+    wheel_init(&w, now);
+    for (n = 0; n < 3; n++) {
+        wheel_nodeinit(&t[n].node);
+        t[n].fired = 0;
+    }
+    wheel_add(&w, &t[0].node, 300);
+    wheel_add(&w, &t[1].node, 70000);
+    wheel_add(&w, &t[2].node, 3);
+    while (w.count > 0)
+        wheel_advance(&w, w.now + wheel_timeout(&w), vexpire, &st);
+    CHECK(st.fired == 3);
+    /*only the one added in the past, it falls due on the next tick*/
+    CHECK(st.early == 0 && st.late == 1);
+    CHECK(wheel_timeout(&w) == UINT64_MAX);
+}
+
+static long long msince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+static void test_oneshot() {
+    epoll_event ev[8];
+    epoll_data_t data;
+    uint64_t count = 0;
+    int epfd, tfd, n;
+
+    printf("oneshot timer is reported once as EPOLLIN\n");
+    epfd = epoll_create(4);
+    data.u64 = 77;
+    tfd = epoll_timer_create(epfd, data);
+    CHECK(tfd > 0);
+    auto start = std::chrono::steady_clock::now();
+    CHECK(epoll_timer_arm(epfd, tfd, 30, 0) == 0);
+    n = epoll_wait(epfd, ev, 8, 2000);
+    CHECK(n == 1 && ev[0].events == EPOLLIN && ev[0].data.u64 == 77);
+    CHECK(msince(start) >= 29 && msince(start) < 1000);
+    CHECK(epoll_timer_read(epfd, tfd, &count) == 0 && count == 1);
+    CHECK(epoll_timer_read(epfd, tfd, &count) < 0 && errno == EAGAIN);
+    CHECK(epoll_wait(epfd, ev, 8, 50) == 0);
+    CHECK(epoll_timer_close(epfd, tfd) == 0);
+    CHECK(epoll_timer_arm(epfd, tfd, 10, 0) < 0 && errno == EBADF);
+    epoll_close(epfd);
+}
+
+static void test_interval() {
+    epoll_event ev[8];
+    epoll_data_t data;
+    uint64_t count = 0;
+    int epfd, tfd;
+
+    printf("interval timer counts the periods nobody waited for\n");
+    epfd = epoll_create(4);
+    data.u64 = 1;
+    tfd = epoll_timer_create(epfd, data);
+    CHECK(epoll_timer_arm(epfd, tfd, 5, 5) == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(epoll_wait(epfd, ev, 8, 0) == 1);
+    CHECK(epoll_timer_read(epfd, tfd, &count) == 0 && count >= 10);
+    /*still running*/
+    CHECK(epoll_wait(epfd, ev, 8, 1000) == 1);
+    CHECK(epoll_timer_cancel(epfd, tfd) == 0);
+    CHECK(epoll_timer_read(epfd, tfd, &count) < 0 && errno == EAGAIN);
+    CHECK(epoll_wait(epfd, ev, 8, 30) == 0);
+    epoll_close(epfd);
+}
+
+static void test_cancel() {
+    epoll_event ev[8];
+    epoll_data_t data;
+    int epfd, tfd[2];
+
+    printf("cancelled timer is never reported\n");
+    epfd = epoll_create(4);
+    data.u64 = 1;
+    tfd[0] = epoll_timer_create(epfd, data);
+    data.u64 = 2;
+    tfd[1] = epoll_timer_create(epfd, data);
+    CHECK(epoll_timer_arm(epfd, tfd[0], 20, 0) == 0);
+    CHECK(epoll_timer_arm(epfd, tfd[1], 40, 0) == 0);
+    CHECK(epoll_timer_cancel(epfd, tfd[0]) == 0);
+    CHECK(epoll_wait(epfd, ev, 8, 1000) == 1 && ev[0].data.u64 == 2);
+    CHECK(epoll_wait(epfd, ev, 8, 50) == 0);
+    epoll_close(epfd);
+}
+
+static void test_with_sockets() {
+    epoll_event ev[8];
+    epoll_event sev = {};
+    epoll_data_t data;
+    socket_t s;
+    int epfd, tfd, fd, n;
+
+    printf("timers and sockets are reported by the same wait\n");
+    epfd = epoll_create(4);
+    s = epoll_sim_socket();
+    fd = epoll_sock2fd(s);
+    sev.events = EPOLLIN;
+    sev.data.u64 = 10;
+    CHECK(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &sev) == 0);
+    data.u64 = 20;
+    tfd = epoll_timer_create(epfd, data);
+    CHECK(epoll_timer_arm(epfd, tfd, 10, 0) == 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    epoll_sim_ready(s, EPOLLIN);
+    n = epoll_wait(epfd, ev, 8, 1000);
+    CHECK(n == 2);
+    CHECK(n == 2 && ev[0].data.u64 + ev[1].data.u64 == 30);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    epoll_freefd(fd);
+    epoll_sim_close(s);
+    epoll_close(epfd);
+}
+
+static void test_arm_wakes_waiter() {
+    epoll_event ev[8];
+    epoll_data_t data;
+    int epfd, tfd, n = 0;
+    long long took = 0;
+
+    printf("arming a timer wakes a wait that would sleep past it\n");
+    epfd = epoll_create(4);
+    data.u64 = 5;
+    tfd = epoll_timer_create(epfd, data);
+    std::thread t([&] {
+        auto start = std::chrono::steady_clock::now();
+        n = epoll_wait(epfd, ev, 8, 5000);
+        took = msince(start);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(epoll_timer_arm(epfd, tfd, 20, 0) == 0);
+    t.join();
+    CHECK(n == 1 && ev[0].data.u64 == 5);
+    CHECK(took >= 60 && took < 2000);
+    epoll_close(epfd);
+}
+
+static void test_pwait2() {
+    epoll_event ev[8];
+    epoll_data_t data;
+    struct timespec ts = {};
+    std::vector<uint64_t> over;
+    uint64_t start, took;
+    int epfd, tfd, n, early = 0;
+
+    printf("epoll_pwait2 keeps sub-ms timeouts and is never early\n");
+    epfd = epoll_create(4);
+    ts.tv_nsec = 1000000000;
+    CHECK(epoll_pwait2(epfd, ev, 8, &ts, NULL) < 0 && errno == EINVAL);
+    ts.tv_nsec = 0;
+    CHECK(epoll_pwait2(epfd, ev, 8, &ts, &ts) < 0 && errno == EINVAL);
+    CHECK(epoll_pwait2(epfd, ev, 8, &ts, NULL) == 0);
+    for (long ns : { 50000L, 250000L, 1500000L, 2750000L }) {
+        ts.tv_nsec = ns;
+        for (n = 0; n < 10; n++) {
+            start = epoll_clock();
+            CHECK(epoll_pwait2(epfd, ev, 8, &ts, NULL) == 0);
+            took = epoll_clock() - start;
+            if (took < (uint64_t)ns)
+                early++;
+            else
+                over.push_back(took - ns);
+        }
+    }
+    CHECK(early == 0);
+    std::sort(over.begin(), over.end());
+    /*median, the tail is up to the scheduler*/
+    CHECK(!over.empty() && over[over.size() / 2] < 500000);
+
+    printf("epoll_wait_until returns at its deadline or with what is ready\n");
+    start = epoll_clock();
+    CHECK(epoll_wait_until(epfd, ev, 8, start - 1) == 0);
+    CHECK(epoll_wait_until(epfd, ev, 8, start + 300000) == 0);
+    CHECK(epoll_clock() >= start + 300000);
+    data.u64 = 9;
+    tfd = epoll_timer_create(epfd, data);
+    CHECK(epoll_timer_arm(epfd, tfd, 5, 0) == 0);
+    start = epoll_clock();
+    CHECK(epoll_wait_until(epfd, ev, 8, start + 2000000000ULL) == 1 && ev[0].data.u64 == 9);
+    CHECK(epoll_clock() - start < 1000000000ULL);
+    CHECK(epoll_timer_arm(epfd, tfd, 5, 0) == 0);
+    CHECK(epoll_pwait2(epfd, ev, 8, NULL, NULL) == 1 && ev[0].data.u64 == 9);
+    epoll_close(epfd);
+}
+
+int main() {
+    epoll_setbackend(&epoll_backend_sim);
+
+    test_wheel();
+    test_wheel_exact();
+    test_oneshot();
+    test_interval();
+    test_cancel();
+    test_with_sockets();
+    test_arm_wakes_waiter();
+    test_pwait2();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,188 @@
+/*@file timerwheel.cpp
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "timerwheel.h"
+
+/*tick granularity of a level, level 1 slots cover 256 ticks each*/
+static int _wheel_shift(int level) {
+    return level == 0 ? 0 : WHEEL_BITS0 + WHEEL_BITS * (level - 1);
+}
+
+static ptimer_node _wheel_slot(ptimer_wheel w, int level, uint64_t tick) {
+    if (level == 0)
+        return &w->slots0[tick & (WHEEL_SLOTS0 - 1)];
+    return &w->slots[level - 1][(tick >> _wheel_shift(level)) & (WHEEL_SLOTS - 1)];
+}
+
+static void _wheel_link(ptimer_node head, ptimer_node n) {
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+/*due is the earliest tick the node may be placed on*/
+static void _wheel_place(ptimer_wheel w, ptimer_node n, uint64_t due) {
+    uint64_t tick = n->expires > due ? n->expires : due;
+    uint64_t delta = tick - w->now;
+    int level;
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < ((uint64_t)1 << _wheel_shift(level + 1)))
+            break;
+    }
+    /*beyond the top level, parked in its last slot and placed again later*/
+    if (level == WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (_wheel_shift(level) + WHEEL_BITS)))
+        tick = w->now + ((uint64_t)1 << (_wheel_shift(level) + WHEEL_BITS)) - 1;
+
+    n->level = level;
+    w->levelcount[level]++;
+    _wheel_link(_wheel_slot(w, level, tick), n);
+}
+
+void wheel_nodeinit(ptimer_node n) {
+    n->prev = n->next = n;
+    n->expires = 0;
+    n->level = -1;
+}
+
+void wheel_init(ptimer_wheel w, uint64_t now) {
+    int level, i;
+
+    w->now = now;
+    w->count = 0;
+    for (level = 0; level < WHEEL_LEVELS; level++)
+        w->levelcount[level] = 0;
+    for (i = 0; i < WHEEL_SLOTS0; i++)
+        wheel_nodeinit(&w->slots0[i]);
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        for (i = 0; i < WHEEL_SLOTS; i++)
+            wheel_nodeinit(&w->slots[level][i]);
+    }
+}
+
+void wheel_add(ptimer_wheel w, ptimer_node n, uint64_t expires) {
+    if (n->level >= 0)
+        wheel_del(w, n);
+    n->expires = expires;
+    w->count++;
+    _wheel_place(w, n, w->now + 1);
+}
+
+void wheel_del(ptimer_wheel w, ptimer_node n) {
+    if (n->level < 0)
+        return;
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->prev = n->next = n;
+    w->levelcount[n->level]--;
+    w->count--;
+    n->level = -1;
+}
+
+/*moves the nodes of one slot down to where they belong from now*/
+static void _wheel_cascade(ptimer_wheel w, int level, uint64_t tick) {
+    ptimer_node head = _wheel_slot(w, level, tick);
+    ptimer_node n;
+
+    while ((n = head->next) != head) {
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+        w->levelcount[level]--;
+        /*tick itself is still to be expired in level 0*/
+        _wheel_place(w, n, tick);
+    }
+}
+
+void wheel_advance(ptimer_wheel w, uint64_t now, void (*expire)(ptimer_node n, void* arg), void* arg) {
+    timer_node due;
+    ptimer_node n;
+    uint64_t tick, step;
+    int level, low;
+
+    while (w->now < now) {
+        if (w->count == 0) {
+            w->now = now;
+            break;
+        }
+
+        /*nothing can fall due before the next cascade of the lowest used level*/
+        for (low = 0; w->levelcount[low] == 0; low++);
+        step = (uint64_t)1 << _wheel_shift(low);
+        tick = (w->now + step) & ~(step - 1);
+        if (tick > now) {
+            w->now = now;
+            break;
+        }
+        w->now = tick;
+
+        for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((tick & (((uint64_t)1 << _wheel_shift(level)) - 1)) == 0)
+                _wheel_cascade(w, level, tick);
+        }
+
+        /*detach the slot first, expire may add nodes back*/
+        n = &w->slots0[tick & (WHEEL_SLOTS0 - 1)];
+        if (n->next == n)
+            continue;
+        due.next = n->next;
+        due.prev = n->prev;
+        due.next->prev = &due;
+        due.prev->next = &due;
+        n->prev = n->next = n;
+
+        while ((n = due.next) != &due) {
+            due.next = n->next;
+            n->next->prev = &due;
+            n->prev = n->next = n;
+            n->level = -1;
+            w->levelcount[0]--;
+            w->count--;
+            expire(n, arg);
+        }
+    }
+}
+
+uint64_t wheel_timeout(ptimer_wheel w) {
+    ptimer_node head;
+    uint64_t block, d;
+    int level, shift;
+
+    if (w->count == 0)
+        return UINT64_MAX;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        if (w->levelcount[level] == 0)
+            continue;
+        shift = _wheel_shift(level);
+        block = w->now >> shift;
+        /*the first used slot ahead, it falls due (level 0) or cascades then*/
+        for (d = 1; d <= (uint64_t)(level == 0 ? WHEEL_SLOTS0 : WHEEL_SLOTS); d++) {
+            head = _wheel_slot(w, level, (block + d) << shift);
+            if (head->next != head)
+                return ((block + d) << shift) - w->now;
+        }
+    }
+    return 1;
+}
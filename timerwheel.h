@@ -0,0 +1,75 @@
+/*@file timerwheel.h
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 phit666
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <stdint.h>
+
+/*
+ * hierarchical timing wheel with 1ms ticks: 256 slots for the next 256ms,
+ * then four levels of 64 slots each covering 64 times the one below, about
+ * 49 days in all (later expiries are parked at the top and cascade down
+ * again). Nodes are intrusive and sit on circular per-slot lists, so add
+ * and del are O(1); advancing touches only the slots that fall due and
+ * jumps over empty stretches.
+ *
+ * Not thread safe, the owner locks around it.
+ */
+
+#define WHEEL_LEVELS 5
+#define WHEEL_BITS0  8
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS0 (1 << WHEEL_BITS0)
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+
+typedef struct _timer_node {
+    struct _timer_node* prev;
+    struct _timer_node* next;
+    uint64_t expires;       /* tick it falls due */
+    int level;              /* -1 when not on the wheel */
+} timer_node, *ptimer_node;
+
+typedef struct _timer_wheel {
+    /*every expiry <= now has been handed out*/
+    uint64_t now;
+    uint32_t count;
+    uint32_t levelcount[WHEEL_LEVELS];
+    timer_node slots0[WHEEL_SLOTS0];
+    timer_node slots[WHEEL_LEVELS - 1][WHEEL_SLOTS];
+} timer_wheel, *ptimer_wheel;
+
+void wheel_init(ptimer_wheel w, uint64_t now);
+void wheel_nodeinit(ptimer_node n);
+/*an expiry <= now falls due on the next advance*/
+void wheel_add(ptimer_wheel w, ptimer_node n, uint64_t expires);
+void wheel_del(ptimer_wheel w, ptimer_node n);
+/*
+ * moves the wheel to now and calls expire for every node due by then, in
+ * tick order. A node is off the wheel when expire runs and may be re-added.
+ */
+void wheel_advance(ptimer_wheel w, uint64_t now, void (*expire)(ptimer_node n, void* arg), void* arg);
+/*
+ * ticks until the wheel needs advancing, UINT64_MAX when empty. Exact for
+ * expiries within 256 ticks, otherwise the next cascade, never late.
+ */
+uint64_t wheel_timeout(ptimer_wheel w);